@@ -3,7 +3,28 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Ticks a read or write request may wait in a device queue
+   before it is dispatched ahead of C-LOOK order.  Reads get the
+   shorter deadline because a thread is usually waiting on them. */
+#define READ_DEADLINE (TIMER_FREQ / 20)
+#define WRITE_DEADLINE (TIMER_FREQ / 2)
+
+/* Maximum number of sectors, and of buffers, in one merged
+   transfer. */
+#define MERGE_MAX 128
+#define MERGE_IOV_CNT 64
+
+/* Number of buckets in a latency histogram.  Bucket 0 counts
+   requests that took less than 2 microseconds, bucket I > 0 those
+   that took [2**I, 2**(I+1)) microseconds, and the last bucket
+   everything slower. */
+#define LATENCY_CNT 24
 
 /* A block device. */
 struct block
@@ -19,6 +40,32 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* A partition forwards its requests to its parent device. */
+    struct block *parent;               /* Parent device, or null. */
+    block_sector_t parent_start;        /* First sector in parent. */
+
+    /* Request queue, used if there is no parent. */
+    struct lock queue_lock;             /* Protects the fields below. */
+    struct condition queue_ready;       /* Signaled on submission. */
+    struct list queue;                  /* Requests in sector order. */
+    bool io_thread;                     /* I/O thread started? */
+    block_sector_t head;                /* Sector after last transfer. */
+    struct block_iovec *merge_iov;      /* Buffers for merged transfers. */
+
+    /* Statistics, kept if there is no parent and protected by
+       queue_lock.  Times are in microseconds. */
+    unsigned long long read_latency[LATENCY_CNT];  /* Read histogram. */
+    unsigned long long write_latency[LATENCY_CNT]; /* Write histogram. */
+    unsigned long long read_bytes;      /* Bytes read. */
+    unsigned long long write_bytes;     /* Bytes written. */
+    unsigned long long dispatch_cnt;    /* Driver calls. */
+    int64_t busy_usecs;                 /* Time spent in driver calls. */
+    size_t depth;                       /* Requests queued or in flight. */
+    size_t max_depth;                   /* Highest value of depth. */
+    int64_t depth_area;                 /* Integral of depth over time. */
+    int64_t depth_time;                 /* Time depth last changed. */
+    int64_t stats_start;                /* Time statistics started. */
   };
 
 /* List of all block devices. */
@@ -28,6 +75,16 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void block_transfer (struct block *, bool write, block_sector_t,
+                            const struct block_iovec *, size_t iov_cnt);
+static block_done_func wake_submitter;
+static thread_func io_thread;
+static list_less_func request_less;
+static struct block_request *next_request (struct block *);
+static void dispatch (struct block *, struct list *batch, size_t iov_cnt);
+static void change_depth (struct block *, int64_t now, int delta);
+static void print_latency (const char *what,
+                           const unsigned long long hist[LATENCY_CNT]);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +177,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +188,359 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that support it do this with as few commands
+   as possible.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  struct block_iovec iov;
+
+  iov.buffer = buffer;
+  iov.cnt = cnt;
+  block_readv (block, sector, &iov, 1);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving the
+   data.  Drivers that support it do this with as few commands as
+   possible.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                      const void *buffer)
+{
+  struct block_iovec iov;
+
+  iov.buffer = (void *) buffer;
+  iov.cnt = cnt;
+  block_writev (block, sector, &iov, 1);
+}
+
+/* Reads consecutive sectors starting at SECTOR from BLOCK into
+   the IOV_CNT buffers in IOV, filling each in turn.  The whole
+   vector is submitted as a single request.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_readv (struct block *block, block_sector_t sector,
+             const struct block_iovec *iov, size_t iov_cnt)
+{
+  block_transfer (block, false, sector, iov, iov_cnt);
+}
+
+/* Writes consecutive sectors starting at SECTOR to BLOCK from the
+   IOV_CNT buffers in IOV, taking each in turn.  The whole vector
+   is submitted as a single request.  Returns after the block
+   device has acknowledged receiving the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_writev (struct block *block, block_sector_t sector,
+              const struct block_iovec *iov, size_t iov_cnt)
+{
+  block_transfer (block, true, sector, iov, iov_cnt);
+}
+
+/* Transfers consecutive sectors starting at SECTOR between BLOCK
+   and the IOV_CNT buffers in IOV, in the direction given by
+   WRITE, and waits for the transfer to finish. */
+static void
+block_transfer (struct block *block, bool write, block_sector_t sector,
+                const struct block_iovec *iov, size_t iov_cnt)
+{
+  struct block_request r;
+  struct semaphore done;
+
+  sema_init (&done, 0);
+  r.write = write;
+  r.sector = sector;
+  r.iov = iov;
+  r.iov_cnt = iov_cnt;
+  r.done = wake_submitter;
+  r.aux = &done;
+  block_submit (block, &r, 1);
+  if (r.cnt > 0)
+    sema_down (&done);
+}
+
+/* Completion function for block_transfer(). */
+static void
+wake_submitter (struct block_request *r)
+{
+  sema_up (r->aux);
+}
+
+/* Queues the CNT requests in REQUESTS for BLOCK, all at once so
+   that the elevator can sort and merge them.  Each request's
+   DONE function is called once it is finished, from BLOCK's I/O
+   thread, except that a request for no sectors is not queued and
+   DONE is never called for it.  A request must stay allocated,
+   and its buffers must not be touched, until its DONE function is
+   called.  The first request for a device starts its I/O
+   thread. */
+void
+block_submit (struct block *block, struct block_request *requests,
+              size_t cnt)
+{
+  int64_t now, deadline;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct block_request *r = &requests[i];
+      size_t j;
+
+      ASSERT (r->done != NULL);
+      ASSERT (!r->write || block->type != BLOCK_FOREIGN);
+
+      r->cnt = 0;
+      for (j = 0; j < r->iov_cnt; j++)
+        r->cnt += r->iov[j].cnt;
+      if (r->cnt > 0)
+        check_sector (block, r->sector + r->cnt - 1);
+
+      if (r->write)
+        block->write_cnt += r->cnt;
+      else
+        block->read_cnt += r->cnt;
+      if (block->parent != NULL)
+        r->sector += block->parent_start;
+    }
+
+  /* Partitions share their disk's queue. */
+  if (block->parent != NULL)
+    {
+      block_submit (block->parent, requests, cnt);
+      return;
+    }
+
+  now = timer_usecs ();
+  lock_acquire (&block->queue_lock);
+  if (!block->io_thread)
+    {
+      char name[sizeof block->name + 3];
+
+      snprintf (name, sizeof name, "%s-io", block->name);
+      block->merge_iov = malloc (MERGE_IOV_CNT * sizeof *block->merge_iov);
+      if (thread_create (name, PRI_MAX, io_thread, block) == TID_ERROR)
+        PANIC ("%s: cannot start I/O thread", block->name);
+      block->io_thread = true;
+      block->stats_start = block->depth_time = now;
+    }
+  deadline = timer_ticks ();
+  for (i = 0; i < cnt; i++)
+    {
+      struct block_request *r = &requests[i];
+      if (r->cnt == 0)
+        continue;
+      r->deadline = deadline + (r->write ? WRITE_DEADLINE : READ_DEADLINE);
+      r->submitted = now;
+      list_insert_ordered (&block->queue, &r->elem, request_less, NULL);
+      change_depth (block, now, 1);
+    }
+  cond_signal (&block->queue_ready, &block->queue_lock);
+  lock_release (&block->queue_lock);
+}
+
+/* Returns true if request A starts at a lower sector than request
+   B.  Requests for the same sector stay in submission order. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+  return a->sector < b->sector;
+}
+
+/* I/O thread for BLOCK, which dispatches its queued requests one
+   batch at a time. */
+static void
+io_thread (void *block_)
+{
+  struct block *block = block_;
+
+  for (;;)
+    {
+      struct block_request *r;
+      struct list batch;
+      size_t cnt, iov_cnt;
+
+      lock_acquire (&block->queue_lock);
+      while (list_empty (&block->queue))
+        cond_wait (&block->queue_ready, &block->queue_lock);
+
+      /* Take the next request, plus any requests in the same
+         direction for the sectors right after it. */
+      list_init (&batch);
+      r = next_request (block);
+      cnt = r->cnt;
+      iov_cnt = r->iov_cnt;
+      for (;;)
+        {
+          struct list_elem *e = list_next (&r->elem);
+          struct block_request *next;
+
+          list_remove (&r->elem);
+          list_push_back (&batch, &r->elem);
+          if (e == list_end (&block->queue) || block->merge_iov == NULL)
+            break;
+          next = list_entry (e, struct block_request, elem);
+          if (next->write != r->write
+              || next->sector != r->sector + r->cnt
+              || cnt + next->cnt > MERGE_MAX
+              || iov_cnt + next->iov_cnt > MERGE_IOV_CNT)
+            break;
+          r = next;
+          cnt += r->cnt;
+          iov_cnt += r->iov_cnt;
+        }
+      block->head = r->sector + r->cnt;
+      lock_release (&block->queue_lock);
+
+      dispatch (block, &batch, iov_cnt);
+    }
+}
+
+/* Returns the request in BLOCK's queue, which must not be empty,
+   to dispatch next: the first request whose deadline has passed,
+   if any, otherwise the first request at or after the current
+   head position, otherwise the lowest-numbered one. */
+static struct block_request *
+next_request (struct block *block)
+{
+  int64_t now = timer_ticks ();
+  struct block_request *late = NULL;
+  struct block_request *ahead = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->deadline <= now && (late == NULL || r->deadline < late->deadline))
+        late = r;
+      if (ahead == NULL && r->sector >= block->head)
+        ahead = r;
+    }
+
+  if (late != NULL)
+    return late;
+  if (ahead != NULL)
+    return ahead;
+  return list_entry (list_front (&block->queue), struct block_request, elem);
+}
+
+/* Transfers the requests in BATCH, which are for consecutive
+   sectors in the same direction and have IOV_CNT buffers in all,
+   to or from BLOCK with a single driver call, then completes
+   each request. */
+static void
+dispatch (struct block *block, struct list *batch, size_t iov_cnt)
+{
+  struct block_request *first
+    = list_entry (list_front (batch), struct block_request, elem);
+  const struct block_iovec *iov = first->iov;
+  struct list_elem *e;
+  int64_t start, now;
+
+  /* Gather the buffers of merged requests into one vector. */
+  if (list_next (&first->elem) != list_end (batch))
+    {
+      size_t i = 0;
+
+      for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+        {
+          struct block_request *r = list_entry (e, struct block_request,
+                                                elem);
+          memcpy (block->merge_iov + i, r->iov, r->iov_cnt * sizeof *r->iov);
+          i += r->iov_cnt;
+        }
+      iov = block->merge_iov;
+    }
+
+  start = timer_usecs ();
+  if (first->write && block->ops->writev != NULL)
+    block->ops->writev (block->aux, first->sector, iov, iov_cnt);
+  else if (!first->write && block->ops->readv != NULL)
+    block->ops->readv (block->aux, first->sector, iov, iov_cnt);
+  else
+    {
+      block_sector_t sector = first->sector;
+      size_t i, j;
+
+      for (i = 0; i < iov_cnt; i++)
+        for (j = 0; j < iov[i].cnt; j++)
+          {
+            uint8_t *buffer = (uint8_t *) iov[i].buffer
+                              + j * BLOCK_SECTOR_SIZE;
+            if (first->write)
+              block->ops->write (block->aux, sector++, buffer);
+            else
+              block->ops->read (block->aux, sector++, buffer);
+          }
+    }
+
+  /* Account for the requests before completing them. */
+  now = timer_usecs ();
+  lock_acquire (&block->queue_lock);
+  block->dispatch_cnt++;
+  block->busy_usecs += now - start;
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      int64_t latency = now - r->submitted;
+      unsigned long long bytes = (unsigned long long) r->cnt
+                                 * BLOCK_SECTOR_SIZE;
+      int bucket = 0;
+
+      while (bucket < LATENCY_CNT - 1 && latency >> (bucket + 1) != 0)
+        bucket++;
+      if (r->write)
+        {
+          block->write_latency[bucket]++;
+          block->write_bytes += bytes;
+        }
+      else
+        {
+          block->read_latency[bucket]++;
+          block->read_bytes += bytes;
+        }
+      change_depth (block, now, -1);
+    }
+  lock_release (&block->queue_lock);
+
+  /* Complete the requests.  A request may be freed by its DONE
+     function, so advance first. */
+  for (e = list_begin (batch); e != list_end (batch); )
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      e = list_next (e);
+      r->done (r);
+    }
+}
+
+/* Changes BLOCK's queue depth by DELTA at time NOW, in
+   microseconds, first adding the time spent at the old depth to
+   the running integral.  BLOCK's queue_lock must be held. */
+static void
+change_depth (struct block *block, int64_t now, int delta)
+{
+  block->depth_area += (int64_t) block->depth * (now - block->depth_time);
+  block->depth_time = now;
+  block->depth += delta;
+  if (block->depth > block->max_depth)
+    block->max_depth = block->depth;
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,10 +564,15 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Prints statistics for each block device used for a Pintos
+   role, then for each device that has transferred data: bytes
+   moved, time spent in the driver, average and peak queue depth,
+   and histograms of request latency from submission to
+   completion.  May be called at any time. */
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -176,13 +585,82 @@ block_print_stats (void)
                   block->read_cnt, block->write_cnt);
         }
     }
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      unsigned long long read_latency[LATENCY_CNT];
+      unsigned long long write_latency[LATENCY_CNT];
+      unsigned long long read_bytes, write_bytes, dispatch_cnt;
+      int64_t now, busy_usecs, elapsed, avg_depth;
+      size_t depth, max_depth;
+      bool locked;
+
+      if (block->parent != NULL || !block->io_thread)
+        continue;
+
+      /* Take a consistent snapshot, then print without the lock.
+         When called from a kernel panic we cannot sleep, so make
+         do with whatever the counters hold. */
+      locked = !intr_context () && intr_get_level () == INTR_ON;
+      if (locked)
+        lock_acquire (&block->queue_lock);
+      now = timer_usecs ();
+      memcpy (read_latency, block->read_latency, sizeof read_latency);
+      memcpy (write_latency, block->write_latency, sizeof write_latency);
+      read_bytes = block->read_bytes;
+      write_bytes = block->write_bytes;
+      dispatch_cnt = block->dispatch_cnt;
+      busy_usecs = block->busy_usecs;
+      depth = block->depth;
+      max_depth = block->max_depth;
+      elapsed = now - block->stats_start;
+      avg_depth = block->depth_area
+                  + (int64_t) depth * (now - block->depth_time);
+      avg_depth = elapsed > 0 ? avg_depth * 100 / elapsed : 0;
+      if (locked)
+        lock_release (&block->queue_lock);
+
+      printf ("%s: %llu bytes read, %llu bytes written, "
+              "%llu commands, %lld us busy\n",
+              block->name, read_bytes, write_bytes, dispatch_cnt,
+              (long long) busy_usecs);
+      printf ("%s: queue depth %zu now, %lld.%02lld average, %zu peak\n",
+              block->name, depth, (long long) avg_depth / 100,
+              (long long) avg_depth % 100, max_depth);
+      print_latency ("read", read_latency);
+      print_latency ("write", write_latency);
+    }
+}
+
+/* Prints the non-empty buckets of latency histogram HIST, labeled
+   WHAT. */
+static void
+print_latency (const char *what, const unsigned long long hist[LATENCY_CNT])
+{
+  int i;
+
+  for (i = 0; i < LATENCY_CNT; i++)
+    if (hist[i] != 0)
+      {
+        if (i == 0)
+          printf ("  %s < 2 us: %llu\n", what, hist[i]);
+        else if (i < LATENCY_CNT - 1)
+          printf ("  %s %lu-%lu us: %llu\n", what,
+                  1ul << i, (1ul << (i + 1)) - 1, hist[i]);
+        else
+          printf ("  %s >= %lu us: %llu\n", what, 1ul << i, hist[i]);
+      }
 }
 
 /* Registers a new block device with the given NAME.  If
    EXTRA_INFO is non-null, it is printed as part of a user
    message.  The block device's SIZE in sectors and its TYPE must
    be provided, as well as the it operation functions OPS, which
-   will be passed AUX in each function call. */
+   will be passed AUX in each function call.  OPS may be null for
+   a device that will be made a partition with block_set_parent(),
+   since a partition's requests go to its parent instead. */
 struct block *
 block_register (const char *name, enum block_type type,
                 const char *extra_info, block_sector_t size,
@@ -200,6 +678,25 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->parent = NULL;
+  block->parent_start = 0;
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_ready);
+  list_init (&block->queue);
+  block->io_thread = false;
+  block->head = 0;
+  block->merge_iov = NULL;
+  memset (block->read_latency, 0, sizeof block->read_latency);
+  memset (block->write_latency, 0, sizeof block->write_latency);
+  block->read_bytes = 0;
+  block->write_bytes = 0;
+  block->dispatch_cnt = 0;
+  block->busy_usecs = 0;
+  block->depth = 0;
+  block->max_depth = 0;
+  block->depth_area = 0;
+  block->depth_time = 0;
+  block->stats_start = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -211,6 +708,17 @@ block_register (const char *name, enum block_type type,
   return block;
 }
 
+/* Makes BLOCK a partition of PARENT that starts at sector START,
+   so that requests for BLOCK go to PARENT's request queue. */
+void
+block_set_parent (struct block *block, struct block *parent,
+                  block_sector_t start)
+{
+  ASSERT (start + block->size <= parent->size);
+  block->parent = parent;
+  block->parent_start = start;
+}
+
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
 static struct block *
@@ -1,8 +1,10 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -14,6 +16,14 @@
    Good enough for devices up to 2 TB. */
 typedef uint32_t block_sector_t;
 
+/* A buffer for CNT consecutive sectors.  An array of these
+   describes a scatter-gather transfer. */
+struct block_iovec
+  {
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    size_t cnt;                 /* Number of sectors. */
+  };
+
 /* Format specifier for printf(), e.g.:
    printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
@@ -53,10 +63,54 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt, void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
+void block_readv (struct block *, block_sector_t,
+                  const struct block_iovec *, size_t iov_cnt);
+void block_writev (struct block *, block_sector_t,
+                   const struct block_iovec *, size_t iov_cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
-/* Statistics. */
+/* Asynchronous block I/O.
+
+   A request is queued with block_submit() and its DONE function
+   is called, from the device's I/O thread, once the transfer is
+   finished.  Each device dispatches its queued requests in
+   C-LOOK order, that is, in ascending sector order starting from
+   the last sector transferred and wrapping around to the lowest
+   queued sector, except that a request that has waited past its
+   deadline is dispatched first.  Adjacent requests in the same
+   direction are merged into a single scatter-gather transfer.
+
+   block_read() and the other synchronous calls above submit a
+   request and wait for it. */
+struct block_request;
+typedef void block_done_func (struct block_request *);
+
+struct block_request
+  {
+    /* Set by the submitter. */
+    bool write;                 /* True to write, false to read. */
+    block_sector_t sector;      /* First sector. */
+    const struct block_iovec *iov; /* Buffers, filled in order. */
+    size_t iov_cnt;             /* Number of buffers. */
+    block_done_func *done;      /* Called on completion. */
+    void *aux;                  /* For use by DONE. */
+
+    /* Owned by the block layer until DONE is called. */
+    size_t cnt;                 /* Total number of sectors. */
+    struct list_elem elem;      /* Element in device queue. */
+    int64_t deadline;           /* Timer tick to dispatch by. */
+    int64_t submitted;          /* Time queued, in microseconds. */
+  };
+
+void block_submit (struct block *, struct block_request *, size_t cnt);
+
+/* Statistics.  Devices with a request queue also keep latency
+   histograms and queue-depth figures, printed along with the
+   per-role counts. */
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
@@ -65,10 +119,21 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer consecutive sectors to or from the
+       IOV_CNT buffers in IOV, in order, with as few commands as
+       possible.  If null, the block layer calls `read' or `write'
+       once per sector instead. */
+    void (*readv) (void *aux, block_sector_t,
+                   const struct block_iovec *iov, size_t iov_cnt);
+    void (*writev) (void *aux, block_sector_t,
+                    const struct block_iovec *iov, size_t iov_cnt);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_set_parent (struct block *, struct block *parent,
+                       block_sector_t start);
 
 #endif /* devices/block.h */
@@ -9,9 +9,18 @@
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   If the PCI bus has an IDE controller capable of bus-master
+   DMA, as the PIIX controllers emulated by QEMU and Bochs are,
+   transfers are done by DMA, up to MAX_SECTORS per command, and
+   the CPU only has to wait for one interrupt per command.
+   Otherwise they are done in PIO mode, which still needs only one
+   command per MAX_SECTORS sectors but one interrupt per
+   sector. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -30,10 +39,25 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master IDE port addresses, relative to the channel's
+   bus master base.  [SFF-8038i] */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
+
+/* Bus Master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from device to memory. */
+
+/* Bus Master Status Register bits. */
+#define BM_STA_ERR 0x02         /* Error (write 1 to clear). */
+#define BM_STA_INTR 0x04        /* Interrupt (write 1 to clear). */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +73,28 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Maximum number of sectors per command. */
+#define MAX_SECTORS 128
+
+/* Physical Region Descriptor, one entry in the table that tells
+   the bus master where in memory to transfer data.  A region may
+   not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Byte count, 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT on last entry. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* PRD table entries per channel, enough for MAX_SECTORS sectors
+   in separate buffers that each cross a 64 kB boundary.  A table
+   may not cross a 64 kB boundary either, which aligning it to its
+   own size ensures. */
+#define PRD_CNT (2 * MAX_SECTORS)
 
 /* An ATA device. */
 struct ata_disk
@@ -72,7 +118,20 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master base port, 0 if no DMA. */
+    struct prd prd_table[PRD_CNT]       /* Bus master PRD table. */
+      __attribute__ ((aligned (PRD_CNT * sizeof (struct prd))));
+
     struct ata_disk devices[2];     /* The devices on this channel. */
+
+    /* Statistics, protected by lock except as noted.  Times are
+       in microseconds. */
+    unsigned long long dma_cnt; /* DMA commands issued. */
+    unsigned long long pio_cnt; /* PIO commands issued. */
+    unsigned long long acquire_cnt;     /* Times lock was acquired. */
+    int64_t wait_usecs;         /* Time spent waiting for lock. */
+    int64_t hold_usecs;         /* Time lock was held, updated
+                                   just before releasing it. */
   };
 
 /* We support the two "legacy" ATA channels found in a standard PC. */
@@ -85,11 +144,23 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
-static void issue_pio_command (struct channel *, uint8_t command);
+static uint16_t find_bus_master (void);
+static uint32_t pci_read_config (int bus, int dev, int func, int reg);
+static void pci_write_config (int bus, int dev, int func, int reg,
+                              uint32_t);
+
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
+static void issue_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
+struct iov_cursor;
+static void transfer_pio (struct ata_disk *, block_sector_t, size_t cnt,
+                          struct iov_cursor *, bool write);
+static bool build_prd_table (struct channel *, struct iov_cursor, size_t cnt);
+static void transfer_dma (struct ata_disk *, block_sector_t, size_t cnt,
+                          bool write);
+
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
@@ -101,6 +172,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -126,6 +198,9 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+      c->dma_cnt = c->pio_cnt = c->acquire_cnt = 0;
+      c->wait_usecs = c->hold_usecs = 0;
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -155,6 +230,60 @@ ide_init (void)
     }
 }
 
+/* Finds an IDE controller on PCI bus 0 that can do bus-master
+   DMA, enables bus mastering on it, and returns its bus master
+   base port.  Returns 0 if there is none. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t class, bar4;
+
+        if ((pci_read_config (0, dev, func, 0x00) & 0xffff) == 0xffff)
+          continue;
+
+        /* Mass storage, IDE, bus master capable. */
+        class = pci_read_config (0, dev, func, 0x08);
+        if ((class >> 16) != 0x0101 || !(class & 0x8000))
+          continue;
+
+        /* BAR 4 must be an I/O port range. */
+        bar4 = pci_read_config (0, dev, func, 0x20);
+        if (!(bar4 & 1) || (bar4 & 0xfffc) == 0)
+          continue;
+
+        /* Enable I/O space and bus mastering. */
+        pci_write_config (0, dev, func, 0x04,
+                          pci_read_config (0, dev, func, 0x04) | 0x05);
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
+/* Returns the 32-bit PCI configuration register REG of function
+   FUNC of device DEV on bus BUS. */
+static uint32_t
+pci_read_config (int bus, int dev, int func, int reg)
+{
+  outl (0xcf8, 0x80000000 | (bus << 16) | (dev << 11) | (func << 8)
+        | (reg & 0xfc));
+  return inl (0xcfc);
+}
+
+/* Sets the 32-bit PCI configuration register REG of function
+   FUNC of device DEV on bus BUS to VALUE. */
+static void
+pci_write_config (int bus, int dev, int func, int reg, uint32_t value)
+{
+  outl (0xcf8, 0x80000000 | (bus << 16) | (dev << 11) | (func << 8)
+        | (reg & 0xfc));
+  outl (0xcfc, value);
+}
+
 /* Disk detection and identification. */
 
 static char *descramble_ata_string (char *, int size);
@@ -272,7 +401,7 @@ identify_ata_device (struct ata_disk *d)
      indicating the device's response is ready, and read the data
      into our buffer. */
   select_device_wait (d);
-  issue_pio_command (c, CMD_IDENTIFY_DEVICE);
+  issue_command (c, CMD_IDENTIFY_DEVICE);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
     {
@@ -337,25 +466,89 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* A position within a vector of sector buffers. */
+struct iov_cursor
+  {
+    const struct block_iovec *iov;      /* Current buffer. */
+    size_t ofs;                         /* Sectors of it already used. */
+  };
+
+/* Returns the buffer for the next sector at CUR and advances CUR
+   past it.  There must be a next sector. */
+static uint8_t *
+cursor_next (struct iov_cursor *cur)
+{
+  while (cur->ofs >= cur->iov->cnt)
+    {
+      cur->iov++;
+      cur->ofs = 0;
+    }
+  return (uint8_t *) cur->iov->buffer + cur->ofs++ * BLOCK_SECTOR_SIZE;
+}
+
+/* Transfers consecutive sectors starting at SEC_NO between disk D
+   and the IOV_CNT buffers in IOV, in the direction given by
+   WRITE, in commands of up to MAX_SECTORS sectors each.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_transfer (struct ata_disk *d, block_sector_t sec_no,
+              const struct block_iovec *iov, size_t iov_cnt, bool write)
 {
-  struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  struct iov_cursor cur;
+  size_t left = 0;
+  size_t i;
+  int64_t start, acquired;
+
+  for (i = 0; i < iov_cnt; i++)
+    left += iov[i].cnt;
+  cur.iov = iov;
+  cur.ofs = 0;
+
+  start = timer_usecs ();
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  acquired = timer_usecs ();
+  c->acquire_cnt++;
+  c->wait_usecs += acquired - start;
+  while (left > 0)
+    {
+      size_t n = left < MAX_SECTORS ? left : MAX_SECTORS;
+
+      if (build_prd_table (c, cur, n))
+        {
+          transfer_dma (d, sec_no, n, write);
+          for (i = 0; i < n; i++)
+            cursor_next (&cur);
+          c->dma_cnt++;
+        }
+      else
+        {
+          transfer_pio (d, sec_no, n, &cur, write);
+          c->pio_cnt++;
+        }
+
+      sec_no += n;
+      left -= n;
+    }
+  c->hold_usecs += timer_usecs () - acquired;
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  struct block_iovec iov;
+
+  iov.buffer = buffer;
+  iov.cnt = 1;
+  ide_transfer (d_, sec_no, &iov, 1, false);
+}
+
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
    BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
    acknowledged receiving the data.
@@ -364,36 +557,89 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  struct block_iovec iov;
+
+  iov.buffer = (void *) buffer;
+  iov.cnt = 1;
+  ide_transfer (d_, sec_no, &iov, 1, true);
+}
+
+/* Reads consecutive sectors starting at SEC_NO from disk D into
+   the IOV_CNT buffers in IOV. */
+static void
+ide_readv (void *d_, block_sector_t sec_no,
+           const struct block_iovec *iov, size_t iov_cnt)
+{
+  ide_transfer (d_, sec_no, iov, iov_cnt, false);
+}
+
+/* Writes consecutive sectors starting at SEC_NO to disk D from
+   the IOV_CNT buffers in IOV.  Returns after the disk has
+   acknowledged receiving the data. */
+static void
+ide_writev (void *d_, block_sector_t sec_no,
+            const struct block_iovec *iov, size_t iov_cnt)
+{
+  ide_transfer (d_, sec_no, iov, iov_cnt, true);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_readv,
+    ide_writev
   };
+
+/* Prints, for each channel that has been used, the number of DMA
+   and PIO commands issued and how long threads waited for and
+   held the channel lock. */
+void
+ide_print_stats (void)
+{
+  size_t chan_no;
+
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
+      enum intr_level old_level;
+      unsigned long long dma_cnt, pio_cnt, acquire_cnt;
+      int64_t wait_usecs, hold_usecs;
+
+      /* Not worth taking the lock, which may be held for a long
+         transfer, just to print. */
+      old_level = intr_disable ();
+      dma_cnt = c->dma_cnt;
+      pio_cnt = c->pio_cnt;
+      acquire_cnt = c->acquire_cnt;
+      wait_usecs = c->wait_usecs;
+      hold_usecs = c->hold_usecs;
+      intr_set_level (old_level);
+
+      if (acquire_cnt == 0)
+        continue;
+      printf ("%s: %llu DMA commands, %llu PIO commands\n",
+              c->name, dma_cnt, pio_cnt);
+      printf ("%s: lock acquired %llu times, %lld us waiting, "
+              "%lld us held\n", c->name, acquire_cnt,
+              (long long) wait_usecs, (long long) hold_usecs);
+    }
+}
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the number of sectors CNT, which must be
+   between 1 and 256, to the disk's sector selection registers.
+   (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= 256);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt & 0xff);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -404,7 +650,7 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 /* Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
 static void
-issue_pio_command (struct channel *c, uint8_t command) 
+issue_command (struct channel *c, uint8_t command) 
 {
   /* Interrupts must be enabled or our semaphore will never be
      up'd by the completion handler. */
@@ -429,6 +675,127 @@ output_sector (struct channel *c, const void *sector)
 {
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
+
+/* Transfers CNT sectors starting at SEC_NO between disk D and the
+   buffers at CUR in PIO mode, with a single command, in the
+   direction given by WRITE.  Advances CUR past them. */
+static void
+transfer_pio (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              struct iov_cursor *cur, bool write)
+{
+  struct channel *c = d->channel;
+  size_t i;
+
+  select_sectors (d, sec_no, cnt);
+  issue_command (c, write ? CMD_WRITE_SECTOR_RETRY : CMD_READ_SECTOR_RETRY);
+  for (i = 0; i < cnt; i++)
+    {
+      if (!write)
+        sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+               d->name, write ? "write" : "read", sec_no + i);
+      if (write)
+        {
+          output_sector (c, cursor_next (cur));
+          sema_down (&c->completion_wait);
+        }
+      else
+        input_sector (c, cursor_next (cur));
+    }
+}
+
+/* Returns the physical address just past the region that PRD
+   describes. */
+static uintptr_t
+prd_end (const struct prd *prd)
+{
+  return prd->addr + (prd->size != 0 ? prd->size : 0x10000);
+}
+
+/* Fills in channel C's PRD table for a DMA transfer of the CNT
+   sectors whose buffers start at CUR.  Kernel virtual memory
+   maps physical memory one-to-one, so each buffer is physically
+   contiguous; physically adjacent buffers share an entry, and
+   entries are split at 64 kB boundaries.
+   Returns false if C cannot do DMA or some buffer is not in
+   kernel memory or not word-aligned, as DMA requires. */
+static bool
+build_prd_table (struct channel *c, struct iov_cursor cur, size_t cnt)
+{
+  struct prd *p = c->prd_table;
+  size_t i;
+
+  if (c->bm_base == 0)
+    return false;
+
+  for (i = 0; i < cnt; i++)
+    {
+      uint8_t *sector = cursor_next (&cur);
+      size_t size = BLOCK_SECTOR_SIZE;
+      uintptr_t addr;
+
+      if (!is_kernel_vaddr (sector) || ((uintptr_t) sector & 1) != 0)
+        return false;
+      addr = vtop (sector);
+      while (size > 0)
+        {
+          size_t chunk = 0x10000 - (addr & 0xffff);
+          if (chunk > size)
+            chunk = size;
+
+          if (p > c->prd_table && (addr & 0xffff) != 0
+              && prd_end (p - 1) == addr)
+            p[-1].size += chunk;
+          else
+            {
+              ASSERT (p < c->prd_table + PRD_CNT);
+              p->addr = addr;
+              p->size = chunk;
+              p->flags = 0;
+              p++;
+            }
+          addr += chunk;
+          size -= chunk;
+        }
+    }
+  p[-1].flags = PRD_EOT;
+  return true;
+}
+
+/* Transfers CNT sectors, at most MAX_SECTORS, starting at SEC_NO
+   between disk D and memory by bus-master DMA, in the direction
+   given by WRITE, according to the PRD table already built by
+   build_prd_table(). */
+static void
+transfer_dma (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t direction = write ? 0 : BM_CMD_READ;
+  uint8_t status;
+
+  ASSERT (cnt >= 1 && cnt <= MAX_SECTORS);
+
+  /* Program the bus master, then the disk, then start. */
+  outl (reg_bm_prdt (c), vtop (c->prd_table));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c),
+        inb (reg_bm_status (c)) | BM_STA_ERR | BM_STA_INTR);
+  select_sectors (d, sec_no, cnt);
+  issue_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
+
+  /* Wait for completion, then stop the bus master. */
+  sema_down (&c->completion_wait);
+  status = inb (reg_bm_status (c));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), status | BM_STA_ERR | BM_STA_INTR);
+  if ((status & BM_STA_ERR) || (inb (reg_alt_status (c)) & STA_ERR))
+    PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+           d->name, write ? "write" : "read", sec_no);
+}
+
 
 /* Low-level ATA primitives. */
 
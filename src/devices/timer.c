@@ -1,6 +1,7 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
@@ -20,11 +21,47 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Tickless mode.  Instead of running the PIT as a periodic
+   timer, each interrupt arms it in one-shot mode for the next
+   event: normally the next tick boundary, but while the CPU is
+   idle the next sleeper's wakeup tick, and in any case the
+   earliest sub-tick sleeper.  Time is kept in PIT cycles since
+   boot; clock_base is that time when the pending event was
+   armed and event_counts is how far off the event is. */
+bool timer_tickless;
+#define TICK_COUNTS ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+#define ONESHOT_MIN (PIT_HZ / 100000)   /* Shortest event, 10 us. */
+#define ONESHOT_MAX 0xffff              /* Longest event, ~55 ms. */
+static int64_t clock_base;
+static uint16_t event_counts;
+static int64_t timer_interrupts;        /* # of timer interrupts taken. */
+
+/* Threads sleeping for less than a tick, ordered by deadline.
+   In tickless mode the timer is armed for the earliest of them;
+   otherwise they are woken by the first tick at or after their
+   deadline. */
+static struct list hires_list;
+
+/* A thread in hires_list. */
+struct hires_sleeper
+  {
+    struct list_elem elem;              /* List element. */
+    struct thread *thread;              /* Sleeping thread. */
+    int64_t deadline;                   /* Wakeup time, in PIT cycles. */
+  };
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
 static intr_handler_func timer_interrupt;
+static void timer_tick (void);
+static int64_t timer_clock (void);
+static void timer_arm (int64_t now);
+static void hires_sleep (int64_t counts);
+static void hires_wake (int64_t now);
+static bool hires_less (const struct list_elem *, const struct list_elem *,
+                        void *aux);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -35,7 +72,11 @@ static void real_time_delay (int64_t num, int32_t denom);
 void
 timer_init (void) 
 {
-  pit_configure_channel (0, 2, TIMER_FREQ);
+  list_init (&hires_list);
+  if (timer_tickless)
+    timer_arm (0);
+  else
+    pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
@@ -72,6 +113,13 @@ timer_ticks (void)
 {
   enum intr_level old_level = intr_disable ();
   int64_t t = ticks;
+  if (timer_tickless)
+    {
+      /* Ticks may have passed since the last interrupt. */
+      int64_t now_ticks = timer_clock () / TICK_COUNTS;
+      if (now_ticks > t)
+        t = now_ticks;
+    }
   intr_set_level (old_level);
   return t;
 }
@@ -84,6 +132,29 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns the number of microseconds since the OS booted,
+   interpolated between ticks by reading the PIT counter.  The
+   result never decreases from one call to the next. */
+int64_t
+timer_usecs (void)
+{
+  static int64_t last;
+  enum intr_level old_level = intr_disable ();
+  int64_t counts, usecs;
+
+  counts = timer_clock ();
+  usecs = counts * 1000000 / PIT_HZ;
+
+  /* In periodic mode the counter reloads before the interrupt
+     that increments `ticks' is taken, which would briefly make
+     the clock run backward. */
+  if (usecs < last)
+    usecs = last;
+  last = usecs;
+  intr_set_level (old_level);
+  return usecs;
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void
@@ -176,16 +247,55 @@ void
 timer_print_stats (void) 
 {
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  if (timer_tickless)
+    printf ("Timer: %"PRId64" interrupts (tickless)\n", timer_interrupts);
 }
 
+/* Called by the scheduler when this CPU switches away from its
+   idle thread.  If the pending event is further away than the
+   next tick boundary, re-arms the timer for that boundary so the
+   new thread's time slice is enforced. */
+void
+timer_leave_idle (void)
+{
+  enum intr_level old_level = intr_disable ();
+  int64_t now = timer_clock ();
+
+  if (clock_base + event_counts > (now / TICK_COUNTS + 1) * TICK_COUNTS)
+    timer_arm (now);
+  intr_set_level (old_level);
+}
+
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
+{
+  timer_interrupts++;
+  if (timer_tickless)
+    {
+      /* Account for every tick boundary passed since the last
+         event, then pick the next event. */
+      int64_t now = timer_clock ();
+      while (ticks < now / TICK_COUNTS)
+        timer_tick ();
+      hires_wake (now);
+      timer_arm (now);
+    }
+  else
+    {
+      timer_tick ();
+      hires_wake (ticks * TICK_COUNTS);
+    }
+}
+
+/* Performs the work of one timer tick. */
+static void
+timer_tick (void)
 {
   ticks++;
   thread_tick ();
 
-  thread_check_awake (timer_ticks());
+  thread_check_awake (ticks);
 
   if (thread_mlfqs)
   {
@@ -205,6 +315,115 @@ timer_interrupt (struct intr_frame *args UNUSED)
   }
 
 }
+
+/* Returns the number of PIT cycles since the timer was started.
+   Interrupts must be off. */
+static int64_t
+timer_clock (void)
+{
+  uint16_t left = pit_read_counter (0);
+
+  /* In periodic mode the counter counts down from TICK_COUNTS
+     once per tick. */
+  if (!timer_tickless)
+    return ticks * TICK_COUNTS + (TICK_COUNTS - left);
+
+  /* After reaching 0 the counter wraps around to 65535 and keeps
+     counting down. */
+  if (left <= event_counts)
+    return clock_base + (event_counts - left);
+  else
+    return clock_base + event_counts + (0x10000 - left);
+}
+
+/* Arms the timer, in tickless mode, for the next event after
+   NOW, in PIT cycles.  Interrupts must be off. */
+static void
+timer_arm (int64_t now)
+{
+  int64_t next_tick = (now / TICK_COUNTS + 1) * TICK_COUNTS;
+  int64_t deadline = next_tick;
+  int64_t delta;
+
+  /* Nothing to do until the next sleeper is due, so let the
+     ticks in between go by without interrupts. */
+  if (thread_cpu_idle ())
+    {
+      int64_t limit = (now + ONESHOT_MAX) / TICK_COUNTS;
+      deadline = thread_next_wakeup (limit) * TICK_COUNTS;
+      if (deadline < next_tick)
+        deadline = next_tick;
+    }
+
+  if (!list_empty (&hires_list))
+    {
+      struct hires_sleeper *s = list_entry (list_front (&hires_list),
+                                            struct hires_sleeper, elem);
+      if (s->deadline < deadline)
+        deadline = s->deadline;
+    }
+
+  delta = deadline - now;
+  if (delta < ONESHOT_MIN)
+    delta = ONESHOT_MIN;
+  if (delta > ONESHOT_MAX)
+    delta = ONESHOT_MAX;
+
+  clock_base = now;
+  event_counts = delta;
+  pit_start_oneshot (0, delta);
+}
+
+/* Blocks the current thread for COUNTS PIT cycles.  In tickless
+   mode, re-arms the timer if it would otherwise go off too late.
+   Interrupts must be on. */
+static void
+hires_sleep (int64_t counts)
+{
+  struct hires_sleeper s;
+  enum intr_level old_level;
+  int64_t now;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  old_level = intr_disable ();
+  now = timer_clock ();
+  s.thread = thread_current ();
+  s.deadline = now + counts;
+  list_insert_ordered (&hires_list, &s.elem, hires_less, NULL);
+  if (timer_tickless && s.deadline < clock_base + event_counts)
+    timer_arm (now);
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* Wakes up every sub-tick sleeper whose deadline is no later
+   than NOW, in PIT cycles. */
+static void
+hires_wake (int64_t now)
+{
+  while (!list_empty (&hires_list))
+    {
+      struct hires_sleeper *s = list_entry (list_front (&hires_list),
+                                            struct hires_sleeper, elem);
+      if (s->deadline > now)
+        break;
+      list_pop_front (&hires_list);
+      thread_unblock (s->thread);
+      if (s->thread->priority > thread_current ()->priority)
+        intr_yield_on_return ();
+    }
+}
+
+/* Orders hires_sleepers by deadline. */
+static bool
+hires_less (const struct list_elem *a_, const struct list_elem *b_,
+            void *aux UNUSED)
+{
+  const struct hires_sleeper *a = list_entry (a_, struct hires_sleeper, elem);
+  const struct hires_sleeper *b = list_entry (b_, struct hires_sleeper, elem);
+  return a->deadline < b->deadline;
+}
 
 /* Returns true if LOOPS iterations waits for more than one timer
    tick, otherwise false. */
@@ -250,6 +469,7 @@ real_time_sleep (int64_t num, int32_t denom)
      1 s / TIMER_FREQ ticks
   */
   int64_t ticks = num * TIMER_FREQ / denom;
+  int64_t counts = num * PIT_HZ / denom;
 
   ASSERT (intr_get_level () == INTR_ON);
   if (ticks > 0)
@@ -259,11 +479,12 @@ real_time_sleep (int64_t num, int32_t denom)
          processes. */                
       timer_sleep (ticks); 
     }
-  else 
+  else if (counts > 0)
     {
-      /* Otherwise, use a busy-wait loop for more accurate
-         sub-tick timing. */
-      real_time_delay (num, denom); 
+      /* Otherwise, block until the deadline instead of spinning.
+         In tickless mode the timer is armed for it; in periodic
+         mode the wakeup waits for the next tick. */
+      hires_sleep (counts);
     }
 }
 
@@ -0,0 +1,576 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Buffer cache for the file system device.
+
+   Every sector of fs_device that the file system reads or writes
+   goes through one of CACHE_CNT entries.  Writes only mark an
+   entry dirty; dirty entries are written back when they are
+   evicted, every CACHE_FLUSH_TICKS timer ticks by the
+   "cache-flush" thread, and by cache_flush() at shutdown.
+
+   Replacement uses the clock algorithm: the hand sweeps the
+   entries, clearing `accessed' bits, and evicts the first entry
+   whose bit is already clear and that nobody is using.
+
+   Locking works in two levels.  cache_lock protects the mapping
+   from sectors to entries and each entry's `pin_cnt' and
+   `accessed'.  An entry's own `lock' protects its data and
+   `dirty', and is held while the entry is read from or written
+   to disk.  A thread pins an entry under cache_lock before
+   acquiring its lock, so unpinned entries are never locked and
+   can be evicted.
+
+   Sectors that are likely to be read soon can be queued with
+   cache_readahead(), and the "cache-readahead" thread then
+   brings them into the cache in the background, so that disk
+   latency overlaps with whatever the reader is doing. */
+
+/* Number of cached sectors. */
+#define CACHE_CNT 64
+
+/* Timer ticks between write-behind flushes. */
+#define CACHE_FLUSH_TICKS TIMER_FREQ
+
+/* Maximum number of queued read-ahead requests. */
+#define READAHEAD_CNT 32
+
+/* Maximum number of sectors loaded by one cache_load() batch. */
+#define LOAD_CNT 8
+
+/* cache_zero() writes zeros from a buffer of ZERO_CNT sectors,
+   with up to ZERO_IOV_CNT copies of it per request. */
+#define ZERO_CNT 8
+#define ZERO_IOV_CNT 32
+
+/* A cached sector. */
+struct cache_entry
+  {
+    struct hash_elem elem;              /* Element in cache_map. */
+    block_sector_t sector;              /* Sector held, if valid. */
+    bool valid;                         /* True if holding a sector. */
+    bool accessed;                      /* Used since last clock sweep? */
+    int pin_cnt;                        /* Number of users. */
+    struct lock lock;                   /* Protects data and dirty. */
+    bool dirty;                         /* Differs from disk? */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_CNT];
+static struct hash cache_map;           /* Valid entries by sector. */
+static struct lock cache_lock;          /* Protects cache_map, pinning. */
+static struct condition cache_unpinned; /* Signaled when pin_cnt hits 0. */
+static size_t clock_hand;               /* Next entry to consider. */
+
+/* Read-ahead queue, a ring buffer protected by cache_lock. */
+static block_sector_t readahead_queue[READAHEAD_CNT];
+static size_t readahead_head;           /* Next request to serve. */
+static size_t readahead_cnt;            /* Number of queued requests. */
+static struct condition readahead_ready; /* Signaled when queued. */
+
+/* Dirty entries being written back by cache_flush(). */
+static struct lock flush_lock;          /* Serializes cache_flush(). */
+static struct cache_entry *flush_entries[CACHE_CNT];
+static struct block_iovec flush_iov[CACHE_CNT];
+static struct block_request flush_requests[CACHE_CNT];
+static struct cache_entry *flush_busy[CACHE_CNT];
+
+static hash_hash_func entry_hash;
+static hash_less_func entry_less;
+static struct cache_entry *cache_get (block_sector_t, bool load);
+static struct cache_entry *cache_claim (block_sector_t, bool wait);
+static block_done_func wake_waiter;
+static struct cache_entry *cache_lookup (block_sector_t);
+static struct cache_entry *cache_evict (bool wait);
+static void cache_put (struct cache_entry *);
+static thread_func flush_thread;
+static thread_func readahead_thread;
+
+/* Initializes the buffer cache and starts its write-behind
+   thread. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  if (!hash_init (&cache_map, entry_hash, entry_less, NULL))
+    PANIC ("buffer cache creation failed");
+  lock_init (&cache_lock);
+  cond_init (&cache_unpinned);
+  cond_init (&readahead_ready);
+  lock_init (&flush_lock);
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      cache[i].valid = false;
+      cache[i].pin_cnt = 0;
+      cache[i].dirty = false;
+      lock_init (&cache[i].lock);
+    }
+
+  thread_create ("cache-flush", PRI_DEFAULT, flush_thread, NULL);
+  thread_create ("cache-readahead", PRI_DEFAULT, readahead_thread, NULL);
+}
+
+/* Copies SIZE bytes starting at offset OFS within SECTOR into
+   BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Copies SIZE bytes from BUFFER into SECTOR starting at offset
+   OFS.  The sector is written back to disk later. */
+void
+cache_write (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  cache_put (e);
+}
+
+/* Asks for SECTOR to be brought into the cache in the background.
+   Does nothing if SECTOR is already cached or too many requests
+   are already pending. */
+void
+cache_readahead (block_sector_t sector)
+{
+  lock_acquire (&cache_lock);
+  if (readahead_cnt < READAHEAD_CNT && cache_lookup (sector) == NULL)
+    {
+      readahead_queue[(readahead_head + readahead_cnt++) % READAHEAD_CNT]
+        = sector;
+      cond_signal (&readahead_ready, &cache_lock);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Brings the CNT sectors starting at SECTOR into the cache, in
+   batches of up to LOAD_CNT sectors.  The sectors of each batch
+   that are not already cached are read with a single
+   submission.  A batch ends early rather than wait for an entry
+   while it holds others, since those it holds might be the ones
+   that everyone else is waiting for. */
+void
+cache_load (block_sector_t sector, size_t cnt)
+{
+  while (cnt > 0)
+    {
+      struct cache_entry *claimed[LOAD_CNT];
+      struct block_iovec iov[LOAD_CNT];
+      struct block_request requests[LOAD_CNT];
+      struct semaphore done;
+      size_t n = cnt < LOAD_CNT ? cnt : LOAD_CNT;
+      size_t claim_cnt = 0, request_cnt = 0;
+      size_t i;
+
+      /* Claim entries for the missing sectors, one request per
+         run of consecutive sectors. */
+      sema_init (&done, 0);
+      lock_acquire (&cache_lock);
+      i = 0;
+      while (i < n)
+        {
+          struct cache_entry *e;
+
+          if (cache_lookup (sector + i) != NULL)
+            {
+              i++;
+              continue;
+            }
+          e = cache_claim (sector + i, false);
+          if (e == NULL)
+            {
+              if (claim_cnt > 0)
+                break;
+              if (cache_lookup (sector + i) == NULL)
+                cond_wait (&cache_unpinned, &cache_lock);
+              continue;
+            }
+          claimed[claim_cnt] = e;
+          iov[claim_cnt].buffer = e->data;
+          iov[claim_cnt].cnt = 1;
+          if (claim_cnt > 0 && claimed[claim_cnt - 1]->sector + 1 == e->sector)
+            requests[request_cnt - 1].iov_cnt++;
+          else
+            {
+              struct block_request *r = &requests[request_cnt++];
+              r->write = false;
+              r->sector = e->sector;
+              r->iov = &iov[claim_cnt];
+              r->iov_cnt = 1;
+              r->done = wake_waiter;
+              r->aux = &done;
+            }
+          claim_cnt++;
+          i++;
+        }
+      lock_release (&cache_lock);
+      n = i;
+
+      block_submit (fs_device, requests, request_cnt);
+      for (i = 0; i < request_cnt; i++)
+        sema_down (&done);
+      for (i = 0; i < claim_cnt; i++)
+        cache_put (claimed[i]);
+
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Sets the CNT sectors starting at SECTOR, which were just
+   allocated, to all zeros.  The zeros are written straight to
+   disk with as few requests as possible, instead of through the
+   cache, and any stale copies in the cache are dropped or
+   zeroed. */
+void
+cache_zero (block_sector_t sector, size_t cnt)
+{
+  static uint8_t zeros[ZERO_CNT * BLOCK_SECTOR_SIZE];
+  struct block_iovec iov[ZERO_IOV_CNT];
+  block_sector_t start = sector;
+  size_t left = cnt;
+  size_t i;
+
+  /* Drop cached copies that nobody is using. */
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      if (e->valid && e->pin_cnt == 0
+          && e->sector >= sector && e->sector < sector + cnt)
+        {
+          hash_delete (&cache_map, &e->elem);
+          e->valid = false;
+          e->dirty = false;
+        }
+    }
+  lock_release (&cache_lock);
+
+  while (left > 0)
+    {
+      size_t iov_cnt = 0;
+      size_t n = 0;
+
+      while (n < left && iov_cnt < ZERO_IOV_CNT)
+        {
+          iov[iov_cnt].buffer = zeros;
+          iov[iov_cnt].cnt = left - n < ZERO_CNT ? left - n : ZERO_CNT;
+          n += iov[iov_cnt++].cnt;
+        }
+      block_writev (fs_device, start, iov, iov_cnt);
+      start += n;
+      left -= n;
+    }
+
+  /* Zero any copies that were in use, or that have been read
+     back in the meantime, in the cache too. */
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      block_sector_t s;
+      bool stale;
+
+      lock_acquire (&cache_lock);
+      s = e->sector;
+      stale = e->valid && s >= sector && s < sector + cnt;
+      lock_release (&cache_lock);
+      if (stale)
+        cache_write (s, zeros, 0, BLOCK_SECTOR_SIZE);
+    }
+}
+
+/* Writes every dirty entry back to disk, submitting them all at
+   once so that the block layer can sort and merge them.  Entries
+   that are locked by someone else are written afterward, one at
+   a time, so that this never waits for an entry's lock while
+   holding others. */
+void
+cache_flush (void)
+{
+  struct semaphore done;
+  size_t cnt = 0, busy_cnt = 0;
+  size_t i;
+
+  lock_acquire (&flush_lock);
+  sema_init (&done, 0);
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      struct block_request *r;
+
+      lock_acquire (&cache_lock);
+      if (!e->valid)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->pin_cnt++;
+      lock_release (&cache_lock);
+
+      if (!lock_try_acquire (&e->lock))
+        {
+          flush_busy[busy_cnt++] = e;
+          continue;
+        }
+      if (!e->dirty)
+        {
+          cache_put (e);
+          continue;
+        }
+
+      /* Keep E locked until it is written. */
+      flush_entries[cnt] = e;
+      flush_iov[cnt].buffer = e->data;
+      flush_iov[cnt].cnt = 1;
+      r = &flush_requests[cnt];
+      r->write = true;
+      r->sector = e->sector;
+      r->iov = &flush_iov[cnt];
+      r->iov_cnt = 1;
+      r->done = wake_waiter;
+      r->aux = &done;
+      e->dirty = false;
+      cnt++;
+    }
+
+  block_submit (fs_device, flush_requests, cnt);
+  for (i = 0; i < cnt; i++)
+    sema_down (&done);
+  for (i = 0; i < cnt; i++)
+    cache_put (flush_entries[i]);
+
+  /* Busy entries are still pinned, so they hold the same sectors. */
+  for (i = 0; i < busy_cnt; i++)
+    {
+      struct cache_entry *e = flush_busy[i];
+
+      lock_acquire (&e->lock);
+      if (e->dirty)
+        {
+          block_write (fs_device, e->sector, e->data);
+          e->dirty = false;
+        }
+      cache_put (e);
+    }
+  lock_release (&flush_lock);
+}
+
+/* Completion function for requests that a thread waits for with
+   the semaphore in their `aux'. */
+static void
+wake_waiter (struct block_request *r)
+{
+  sema_up (r->aux);
+}
+
+/* Returns the pinned and locked entry that holds SECTOR,
+   bringing SECTOR into the cache if necessary.  If LOAD is false,
+   the caller is about to overwrite the whole sector, so a newly
+   cached sector is not read from disk. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool load)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  do
+    {
+      e = cache_lookup (sector);
+      if (e != NULL)
+        {
+          e->pin_cnt++;
+          e->accessed = true;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          return e;
+        }
+      e = cache_claim (sector, true);
+    }
+  while (e == NULL);
+  lock_release (&cache_lock);
+
+  if (load)
+    block_read (fs_device, sector, e->data);
+  return e;
+}
+
+/* Evicts an entry, makes it hold SECTOR, which must not be
+   cached, and returns it pinned and locked but without SECTOR's
+   contents.  Others that want SECTOR find the entry and wait on
+   its lock until the caller has filled it in.  If every entry is
+   pinned, waits for one to be unpinned if WAIT is true, or
+   returns a null pointer otherwise.  Also returns a null pointer
+   if someone else cached SECTOR while a dirty victim was being
+   written back.  cache_lock must be held, but is released during
+   that write. */
+static struct cache_entry *
+cache_claim (block_sector_t sector, bool wait)
+{
+  struct cache_entry *e;
+
+  for (;;)
+    {
+      /* The victim is unpinned, so its lock is free. */
+      e = cache_evict (wait);
+      if (e == NULL)
+        return NULL;
+      lock_acquire (&e->lock);
+      e->pin_cnt = 1;
+      if (!e->valid || !e->dirty)
+        break;
+
+      /* Write a dirty victim back without holding cache_lock.  It
+         stays in cache_map under its old sector, pinned and
+         locked, so that anyone who wants that sector meanwhile
+         waits on its lock instead of reading stale data from
+         disk. */
+      lock_release (&cache_lock);
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+      lock_acquire (&cache_lock);
+
+      /* Reuse the victim unless someone pinned it meanwhile, in
+         which case they get its old sector back and we look for
+         another victim, or unless SECTOR has been cached. */
+      if (e->pin_cnt == 1 && cache_lookup (sector) == NULL)
+        break;
+      lock_release (&e->lock);
+      if (--e->pin_cnt == 0)
+        cond_signal (&cache_unpinned, &cache_lock);
+      if (cache_lookup (sector) != NULL)
+        return NULL;
+    }
+
+  if (e->valid)
+    hash_delete (&cache_map, &e->elem);
+  e->sector = sector;
+  e->valid = true;
+  e->accessed = true;
+  e->dirty = false;
+  hash_insert (&cache_map, &e->elem);
+  return e;
+}
+
+/* Unlocks and unpins entry E. */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  if (--e->pin_cnt == 0)
+    cond_signal (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Returns the valid entry for SECTOR, or a null pointer if
+   SECTOR is not cached.  cache_lock must be held. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  struct cache_entry key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&cache_map, &key.elem);
+  return e != NULL ? hash_entry (e, struct cache_entry, elem) : NULL;
+}
+
+/* Chooses an unpinned entry to reuse, by the clock algorithm.
+   If there is none, waits for one to become unpinned if WAIT is
+   true, or returns a null pointer otherwise.  cache_lock must be
+   held. */
+static struct cache_entry *
+cache_evict (bool wait)
+{
+  for (;;)
+    {
+      size_t i;
+
+      /* Two sweeps clear every accessed bit on the way. */
+      for (i = 0; i < 2 * CACHE_CNT; i++)
+        {
+          struct cache_entry *e = &cache[clock_hand];
+          clock_hand = (clock_hand + 1) % CACHE_CNT;
+
+          if (!e->valid)
+            return e;
+          if (e->pin_cnt > 0)
+            continue;
+          if (e->accessed)
+            e->accessed = false;
+          else
+            return e;
+        }
+      if (!wait)
+        return NULL;
+      cond_wait (&cache_unpinned, &cache_lock);
+    }
+}
+
+/* Returns a hash value for cache entry E. */
+static unsigned
+entry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct cache_entry, elem)->sector);
+}
+
+/* Returns true if cache entry A precedes cache entry B. */
+static bool
+entry_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct cache_entry, elem)->sector
+          < hash_entry (b, struct cache_entry, elem)->sector);
+}
+
+/* Serves read-ahead requests, in the order they were made. */
+static void
+readahead_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+
+      lock_acquire (&cache_lock);
+      while (readahead_cnt == 0)
+        cond_wait (&readahead_ready, &cache_lock);
+      sector = readahead_queue[readahead_head];
+      readahead_head = (readahead_head + 1) % READAHEAD_CNT;
+      readahead_cnt--;
+      lock_release (&cache_lock);
+
+      cache_put (cache_get (sector, true));
+    }
+}
+
+/* Periodically writes dirty entries back to disk, so that a
+   crash loses at most CACHE_FLUSH_TICKS worth of writes. */
+static void
+flush_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (CACHE_FLUSH_TICKS);
+      cache_flush ();
+    }
+}
@@ -1,7 +1,11 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
+
+/* Read-ahead window bounds, in sectors. */
+#define READAHEAD_MIN 2
+#define READAHEAD_MAX 16
 
 /* An open file. */
 struct file 
@@ -9,26 +13,45 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+
+    /* Sequential read detection. */
+    off_t ra_next;              /* Where a sequential read would start. */
+    off_t ra_end;               /* End of data requested so far. */
+    int ra_sectors;             /* Read-ahead window, 0 if random. */
   };
 
+/* Cache that open files are allocated from. */
+static struct kmem_cache *file_cache;
+
+static void file_readahead (struct file *, off_t start, off_t end);
+
+/* Initializes the file module. */
+void
+file_init (void)
+{
+  file_cache = kmem_cache_create ("file", sizeof (struct file), 0, NULL);
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) 
 {
-  struct file *file = calloc (1, sizeof *file);
+  struct file *file = kmem_cache_alloc (file_cache);
   if (inode != NULL && file != NULL)
     {
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = file->ra_end = 0;
+      file->ra_sectors = 0;
       return file;
     }
   else
     {
       inode_close (inode);
-      free (file);
+      kmem_cache_free (file_cache, file);
       return NULL; 
     }
 }
@@ -49,7 +72,7 @@ file_close (struct file *file)
     {
       file_allow_write (file);
       inode_close (file->inode);
-      free (file); 
+      kmem_cache_free (file_cache, file);
     }
 }
 
@@ -69,6 +92,7 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  file_readahead (file, file->pos, file->pos + bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -81,15 +105,16 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  file_readahead (file, file_ofs, file_ofs + bytes_read);
+  return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the file cannot grow.
+   Writing past end of file extends the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
@@ -102,9 +127,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the file cannot grow.
+   Writing past end of file extends the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -166,3 +190,36 @@ file_tell (struct file *file)
   ASSERT (file != NULL);
   return file->pos;
 }
+
+/* Notes that bytes START through END of FILE were just read.  If
+   the read began where the previous one ended, the access looks
+   sequential, so this starts reading the following sectors in
+   the background, doubling the window on each sequential read up
+   to READAHEAD_MAX sectors.  Any other read resets the window. */
+static void
+file_readahead (struct file *file, off_t start, off_t end)
+{
+  off_t limit;
+
+  if (start != file->ra_next)
+    {
+      file->ra_next = file->ra_end = end;
+      file->ra_sectors = 0;
+      return;
+    }
+  file->ra_next = end;
+  if (file->ra_sectors == 0)
+    file->ra_sectors = READAHEAD_MIN;
+  else if (file->ra_sectors < READAHEAD_MAX)
+    file->ra_sectors *= 2;
+
+  /* Request only what earlier reads have not already requested. */
+  limit = end + file->ra_sectors * BLOCK_SECTOR_SIZE;
+  if (file->ra_end < end)
+    file->ra_end = end;
+  if (file->ra_end < limit)
+    {
+      inode_readahead (file->inode, limit - file->ra_end, file->ra_end);
+      file->ra_end = limit;
+    }
+}
@@ -1,23 +1,59 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A run of sectors that are consecutive both in a file and on
+   disk. */
+struct extent
+  {
+    uint32_t offset;                    /* First file sector covered. */
+    block_sector_t start;               /* First disk sector. */
+    uint32_t count;                     /* Number of sectors. */
+  };
+
+/* Number of extents stored in the inode itself, number of
+   indirect extent blocks, and number of extents in each. */
+#define DIRECT_CNT 30
+#define INDIRECT_CNT 35
+#define EXTENTS_PER_BLOCK 42
+
+/* Maximum number of extents in a file. */
+#define EXTENT_MAX (DIRECT_CNT + INDIRECT_CNT * EXTENTS_PER_BLOCK)
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   A file's data is described by its extents, in order of file
+   offset, with no gaps: extent I+1 starts at the file sector
+   where extent I ends.  The first DIRECT_CNT extents are stored
+   here and the rest in the indirect extent blocks. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t extent_cnt;                /* Number of extents. */
+    struct extent extents[DIRECT_CNT];  /* First extents. */
+    block_sector_t indirect[INDIRECT_CNT]; /* Extent blocks. */
+  };
+
+/* Indirect extent block.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_block
+  {
+    struct extent extents[EXTENTS_PER_BLOCK]; /* More extents. */
+    uint32_t unused[2];                 /* Not used. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,40 +64,185 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/* Maximum number of closed inodes kept in memory. */
+#define INODE_CACHE_CNT 64
+
+/* Maximum number of sectors that one inode_read_at() loads into
+   the buffer cache up front. */
+#define PREFETCH_CNT 8
+
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in inode table. */
+    struct list_elem unused_elem;       /* Element in unused_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct inode_disk data;             /* Inode content. */
+    struct extent *extents;             /* All data.extent_cnt extents. */
+    size_t extent_cap;                  /* Allocated size of `extents'. */
+    struct lock extent_lock;            /* Protects the extents, the
+                                           extent count and the length. */
   };
 
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   POS.  Takes INODE's extent_lock, because another thread may be
+   growing INODE and reallocating its extents. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
+  uint32_t sector = pos / BLOCK_SECTOR_SIZE;
+  block_sector_t result;
+  size_t lo, hi;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  lock_acquire (&inode->extent_lock);
+  if (pos >= inode->data.length)
+    {
+      lock_release (&inode->extent_lock);
+      return -1;
+    }
+
+  /* Binary search for the last extent that starts at or before
+     SECTOR. */
+  lo = 0;
+  hi = inode->data.extent_cnt;
+  ASSERT (hi > 0);
+  while (hi - lo > 1)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (inode->extents[mid].offset <= sector)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  result = inode->extents[lo].start + (sector - inode->extents[lo].offset);
+  lock_release (&inode->extent_lock);
+  return result;
+}
+
+/* Returns the number of data sectors allocated to INODE, which
+   may exceed what its length requires if growing it failed.
+   INODE's extent_lock must be held, unless no other thread can
+   see INODE. */
+static size_t
+allocated_sectors (const struct inode *inode)
+{
+  size_t cnt = inode->data.extent_cnt;
+  return cnt > 0 ? inode->extents[cnt - 1].offset
+                   + inode->extents[cnt - 1].count : 0;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Table of in-memory inodes, keyed by sector, so that opening a
+   single inode twice returns the same `struct inode'.
+
+   An inode stays in the table after its last opener closes it,
+   so that reopening it does not have to read it from disk again.
+   Such inodes, with open_cnt == 0, are also kept on
+   unused_inodes in order from least to most recently closed, and
+   the least recently closed one is evicted once there are more
+   than INODE_CACHE_CNT of them.  Removed inodes are never kept.
+
+   inode_lock protects the table, the unused list, and every
+   inode's open_cnt.  It is not held while an inode is read from
+   disk, so two threads may load the same inode at once; the one
+   that inserts it into the table second discards its copy and
+   uses the first one instead. */
+static struct hash inode_table;
+static struct list unused_inodes;
+static size_t unused_cnt;               /* Length of unused_inodes. */
+static struct lock inode_lock;
+
+/* Cache that in-memory inodes are allocated from. */
+static struct kmem_cache *inode_cache;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+static struct inode *inode_lookup (block_sector_t);
+static struct inode *inode_reuse (struct inode *);
+static void inode_evict (struct inode *);
+static bool inode_load_extents (struct inode *);
+static void inode_release_data (struct inode *);
+static bool inode_grow (struct inode *, off_t length);
+static bool add_extent (struct inode *, block_sector_t start, size_t cnt);
+static void write_extents (struct inode *, size_t first);
+static void inode_prefetch (struct inode *, off_t size, off_t offset);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&inode_table, inode_hash, inode_less, NULL))
+    PANIC ("inode table creation failed");
+  list_init (&unused_inodes);
+  lock_init (&inode_lock);
+  inode_cache = kmem_cache_create ("inode", sizeof (struct inode), 0, NULL);
+}
+
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if inode A precedes inode B. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  const struct inode *inode_a = hash_entry (a, struct inode, elem);
+  const struct inode *inode_b = hash_entry (b, struct inode, elem);
+  return inode_a->sector < inode_b->sector;
+}
+
+/* Returns the in-memory inode for SECTOR, or a null pointer if
+   there is none. */
+static struct inode *
+inode_lookup (block_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&inode_table, &key.elem);
+  return e != NULL ? hash_entry (e, struct inode, elem) : NULL;
+}
+
+/* Adds an opener to INODE, which is in the inode table, taking
+   it off the unused list if it had no openers, and returns it.
+   inode_lock must be held. */
+static struct inode *
+inode_reuse (struct inode *inode)
+{
+  ASSERT (lock_held_by_current_thread (&inode_lock));
+
+  if (inode->open_cnt++ == 0)
+    {
+      list_remove (&inode->unused_elem);
+      unused_cnt--;
+    }
+  return inode;
+}
+
+/* Drops INODE, which must have no openers, from memory.
+   inode_lock must be held. */
+static void
+inode_evict (struct inode *inode)
+{
+  ASSERT (lock_held_by_current_thread (&inode_lock));
+  ASSERT (inode->open_cnt == 0);
+
+  list_remove (&inode->unused_elem);
+  unused_cnt--;
+  hash_delete (&inode_table, &inode->elem);
+  free (inode->extents);
+  kmem_cache_free (inode_cache, inode);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -73,36 +254,49 @@ bool
 inode_create (block_sector_t sector, off_t length)
 {
   struct inode_disk *disk_inode = NULL;
+  struct inode *inode, *stale;
   bool success = false;
 
   ASSERT (length >= 0);
 
+  /* SECTOR was free, so any inode still cached for it is stale. */
+  lock_acquire (&inode_lock);
+  stale = inode_lookup (sector);
+  if (stale != NULL)
+    inode_evict (stale);
+  lock_release (&inode_lock);
+
   /* If this assertion fails, the inode structure is not exactly
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct extent_block) == BLOCK_SECTOR_SIZE);
 
+  /* Write an empty inode, then grow it to LENGTH. */
   disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
+  if (disk_inode == NULL)
+    return false;
+  disk_inode->length = 0;
+  disk_inode->magic = INODE_MAGIC;
+  cache_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+  free (disk_inode);
+
+  inode = inode_open (sector);
+  if (inode == NULL)
+    return false;
+  success = inode_grow (inode, length);
+  if (!success)
     {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
-      free (disk_inode);
+      /* Leave SECTOR itself to the caller. */
+      inode_release_data (inode);
+      lock_acquire (&inode_lock);
+      hash_delete (&inode_table, &inode->elem);
+      lock_release (&inode_lock);
+      free (inode->extents);
+      kmem_cache_free (inode_cache, inode);
+      return false;
     }
-  return success;
+  inode_close (inode);
+  return true;
 }
 
 /* Reads an inode from SECTOR
@@ -111,42 +305,92 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
+  struct hash_elem *old;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already in memory. */
+  lock_acquire (&inode_lock);
+  inode = inode_lookup (sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode_reuse (inode);
+      lock_release (&inode_lock);
+      return inode;
     }
+  lock_release (&inode_lock);
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (inode_cache);
   if (inode == NULL)
     return NULL;
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  lock_init (&inode->extent_lock);
+  cache_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  if (!inode_load_extents (inode))
+    {
+      kmem_cache_free (inode_cache, inode);
+      return NULL;
+    }
+
+  /* Someone else may have loaded the same inode meanwhile, in
+     which case theirs wins. */
+  lock_acquire (&inode_lock);
+  old = hash_insert (&inode_table, &inode->elem);
+  if (old != NULL)
+    {
+      free (inode->extents);
+      kmem_cache_free (inode_cache, inode);
+      inode = inode_reuse (hash_entry (old, struct inode, elem));
+    }
+  lock_release (&inode_lock);
   return inode;
 }
 
+/* Reads all of INODE's extents into memory.
+   Returns false if memory allocation fails. */
+static bool
+inode_load_extents (struct inode *inode)
+{
+  size_t cnt = inode->data.extent_cnt;
+  size_t i;
+
+  ASSERT (cnt <= EXTENT_MAX);
+
+  inode->extent_cap = cnt > DIRECT_CNT ? cnt : DIRECT_CNT;
+  inode->extents = malloc (inode->extent_cap * sizeof *inode->extents);
+  if (inode->extents == NULL)
+    return false;
+
+  for (i = 0; i < cnt && i < DIRECT_CNT; i++)
+    inode->extents[i] = inode->data.extents[i];
+  for (; i < cnt; i += EXTENTS_PER_BLOCK)
+    {
+      size_t block_cnt = cnt - i;
+      if (block_cnt > EXTENTS_PER_BLOCK)
+        block_cnt = EXTENTS_PER_BLOCK;
+      cache_read (inode->data.indirect[(i - DIRECT_CNT) / EXTENTS_PER_BLOCK],
+                  inode->extents + i, 0,
+                  block_cnt * sizeof *inode->extents);
+    }
+  return true;
+}
+
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&inode_lock);
+      ASSERT (inode->open_cnt > 0);
+      inode->open_cnt++;
+      lock_release (&inode_lock);
+    }
   return inode;
 }
 
@@ -158,8 +402,11 @@ inode_get_inumber (const struct inode *inode)
 }
 
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If this was the last reference to INODE, keeps it cached for
+   later reopening, evicting the least recently closed inode if
+   too many are cached.
+   If INODE was also a removed inode, frees its blocks and its
+   memory instead. */
 void
 inode_close (struct inode *inode) 
 {
@@ -168,21 +415,43 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
+  lock_acquire (&inode_lock);
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
+      /* Deallocate blocks and memory if removed. */
       if (inode->removed) 
         {
+          hash_delete (&inode_table, &inode->elem);
+          lock_release (&inode_lock);
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          inode_release_data (inode);
+          free (inode->extents);
+          kmem_cache_free (inode_cache, inode);
+          return;
         }
 
-      free (inode); 
+      /* Otherwise keep it cached. */
+      list_push_back (&unused_inodes, &inode->unused_elem);
+      if (++unused_cnt > INODE_CACHE_CNT)
+        inode_evict (list_entry (list_front (&unused_inodes),
+                                 struct inode, unused_elem));
     }
+  lock_release (&inode_lock);
+}
+
+/* Returns INODE's data sectors and indirect blocks, but not its
+   inode sector, to the free map. */
+static void
+inode_release_data (struct inode *inode)
+{
+  size_t cnt = inode->data.extent_cnt;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    free_map_release (inode->extents[i].start, inode->extents[i].count);
+  for (i = DIRECT_CNT; i < cnt; i += EXTENTS_PER_BLOCK)
+    free_map_release (inode->data.indirect[(i - DIRECT_CNT)
+                                           / EXTENTS_PER_BLOCK], 1);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -202,7 +471,9 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+
+  if (size > BLOCK_SECTOR_SIZE)
+    inode_prefetch (inode, size, offset);
 
   while (size > 0) 
     {
@@ -220,51 +491,84 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
   return bytes_read;
 }
 
+/* Brings the data in INODE from OFFSET up to OFFSET + SIZE, but
+   no more than PREFETCH_CNT sectors, into the buffer cache, with
+   one batched read per run of sectors that are consecutive on
+   disk. */
+static void
+inode_prefetch (struct inode *inode, off_t size, off_t offset)
+{
+  off_t end = offset + size;
+  block_sector_t run_start = 0;
+  size_t run_cnt = 0;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  offset = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE);
+  if (end > offset + PREFETCH_CNT * BLOCK_SECTOR_SIZE)
+    end = offset + PREFETCH_CNT * BLOCK_SECTOR_SIZE;
+
+  for (; offset < end; offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset);
+      if (run_cnt > 0 && sector == run_start + run_cnt)
+        run_cnt++;
+      else
+        {
+          if (run_cnt > 0)
+            cache_load (run_start, run_cnt);
+          run_start = sector;
+          run_cnt = 1;
+        }
+    }
+  if (run_cnt > 0)
+    cache_load (run_start, run_cnt);
+}
+
+/* Starts bringing the data in INODE from OFFSET up to
+   OFFSET + SIZE into the buffer cache in the background, stopping
+   at end of file. */
+void
+inode_readahead (struct inode *inode, off_t size, off_t offset)
+{
+  off_t end = offset + size;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    cache_readahead (byte_to_sector (inode, offset));
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the inode cannot grow enough or an error
+   occurs.  A write past end of file extends the inode, and any
+   gap between the old end of file and OFFSET reads as zeros. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
   if (inode->deny_write_cnt)
     return 0;
 
+  if (size > 0 && offset + size > inode_length (inode))
+    inode_grow (inode, offset + size);
+
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
@@ -281,42 +585,171 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      cache_write (sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
   return bytes_written;
 }
 
+/* Extends INODE to LENGTH bytes, allocating and zeroing sectors
+   as needed, and writes the new inode to disk.  Each new run of
+   sectors is placed right after the file's last sector if
+   possible, so that it merges into the last extent, and
+   otherwise is allocated as a new extent as large as the free
+   map allows.
+   Returns true if successful, false if the disk is full or the
+   file has too many extents, in which case the length is
+   unchanged.  Holds INODE's extent_lock throughout, so that
+   concurrent growers take turns and lookups never see a
+   half-updated extent array. */
+static bool
+inode_grow (struct inode *inode, off_t length)
+{
+  size_t old_cnt, have, need;
+  bool success = true;
+
+  lock_acquire (&inode->extent_lock);
+  if (length <= inode->data.length)
+    {
+      lock_release (&inode->extent_lock);
+      return true;
+    }
+  old_cnt = inode->data.extent_cnt;
+  have = allocated_sectors (inode);
+  need = bytes_to_sectors (length);
+
+  while (have < need)
+    {
+      size_t cnt = need - have;
+      size_t last = inode->data.extent_cnt;
+      block_sector_t start;
+      bool allocated = false;
+
+      /* Find the largest run we can get, preferring to extend
+         the last extent in place. */
+      for (;;)
+        {
+          if (last > 0)
+            {
+              start = inode->extents[last - 1].start
+                      + inode->extents[last - 1].count;
+              allocated = free_map_allocate_at (start, cnt);
+            }
+          if (!allocated)
+            allocated = free_map_allocate (cnt, &start);
+          if (allocated || cnt == 1)
+            break;
+          cnt /= 2;
+        }
+      if (!allocated)
+        {
+          success = false;
+          break;
+        }
+      if (!add_extent (inode, start, cnt))
+        {
+          free_map_release (start, cnt);
+          success = false;
+          break;
+        }
+
+      cache_zero (start, cnt);
+      have += cnt;
+    }
+
+  if (success)
+    inode->data.length = length;
+  write_extents (inode, old_cnt > 0 ? old_cnt - 1 : 0);
+  lock_release (&inode->extent_lock);
+  return success;
+}
+
+/* Appends CNT sectors starting at START to INODE's data, merging
+   them into the last extent if they are contiguous with it.
+   Returns false if INODE would need more than EXTENT_MAX extents
+   or memory or an indirect block cannot be allocated.
+   INODE's extent_lock must be held. */
+static bool
+add_extent (struct inode *inode, block_sector_t start, size_t cnt)
+{
+  size_t n = inode->data.extent_cnt;
+  struct extent *e;
+
+  ASSERT (lock_held_by_current_thread (&inode->extent_lock));
+
+  if (n > 0 && inode->extents[n - 1].start + inode->extents[n - 1].count
+               == start)
+    {
+      inode->extents[n - 1].count += cnt;
+      return true;
+    }
+  if (n == EXTENT_MAX)
+    return false;
+
+  if (n == inode->extent_cap)
+    {
+      size_t new_cap = inode->extent_cap * 2;
+      struct extent *new_extents;
+
+      if (new_cap > EXTENT_MAX)
+        new_cap = EXTENT_MAX;
+      new_extents = realloc (inode->extents, new_cap * sizeof *new_extents);
+      if (new_extents == NULL)
+        return false;
+      inode->extents = new_extents;
+      inode->extent_cap = new_cap;
+    }
+
+  /* The first extent in an indirect block needs the block. */
+  if (n >= DIRECT_CNT && (n - DIRECT_CNT) % EXTENTS_PER_BLOCK == 0
+      && !free_map_allocate (1, &inode->data.indirect[(n - DIRECT_CNT)
+                                                      / EXTENTS_PER_BLOCK]))
+    return false;
+
+  e = &inode->extents[n];
+  e->offset = allocated_sectors (inode);
+  e->start = start;
+  e->count = cnt;
+  inode->data.extent_cnt++;
+  return true;
+}
+
+/* Writes INODE's on-disk inode, and the indirect blocks that
+   hold extent FIRST and later ones, to disk. */
+static void
+write_extents (struct inode *inode, size_t first)
+{
+  size_t cnt = inode->data.extent_cnt;
+  size_t i;
+
+  for (i = 0; i < cnt && i < DIRECT_CNT; i++)
+    inode->data.extents[i] = inode->extents[i];
+  cache_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+
+  if (first < DIRECT_CNT)
+    first = DIRECT_CNT;
+  for (i = first - (first - DIRECT_CNT) % EXTENTS_PER_BLOCK; i < cnt;
+       i += EXTENTS_PER_BLOCK)
+    {
+      struct extent_block block;
+      size_t block_cnt = cnt - i;
+      if (block_cnt > EXTENTS_PER_BLOCK)
+        block_cnt = EXTENTS_PER_BLOCK;
+
+      memset (&block, 0, sizeof block);
+      memcpy (block.extents, inode->extents + i,
+              block_cnt * sizeof *inode->extents);
+      cache_write (inode->data.indirect[(i - DIRECT_CNT)
+                                        / EXTENTS_PER_BLOCK],
+                   &block, 0, BLOCK_SECTOR_SIZE);
+    }
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
@@ -60,6 +60,54 @@ byte_cnt (size_t bit_cnt)
   return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Returns a bit mask in which the bits of element ELEM that
+   correspond to bits START through END - 1 of the bitmap are set
+   to 1 and the rest are set to 0.  ELEM must contain at least one
+   of those bits. */
+static inline elem_type
+range_mask (size_t elem, size_t start, size_t end)
+{
+  size_t first = elem * ELEM_BITS;
+  elem_type mask = (elem_type) -1;
+
+  if (start > first)
+    mask &= (elem_type) -1 << (start - first);
+  if (end < first + ELEM_BITS)
+    mask &= ((elem_type) 1 << (end - first)) - 1;
+  return mask;
+}
+
+/* Returns the number of bits set to 1 in X. */
+static inline size_t
+popcount (elem_type x)
+{
+  /* Sum adjacent bits, then pairs, then nibbles, in parallel,
+     then add up the bytes with a multiply. */
+  x -= (x >> 1) & ((elem_type) -1 / 3);
+  x = (x & ((elem_type) -1 / 15 * 3)) + ((x >> 2) & ((elem_type) -1 / 15 * 3));
+  x = (x + (x >> 4)) & ((elem_type) -1 / 255 * 15);
+  return (x * ((elem_type) -1 / 255)) >> ((sizeof x - 1) * CHAR_BIT);
+}
+
+/* Returns the number of trailing 0 bits in X, which must be
+   nonzero. */
+static inline size_t
+ctz (elem_type x)
+{
+  return __builtin_ctzl (x);
+}
+
+/* Atomically sets the bits of *E that are 1 in MASK to VALUE. */
+static inline void
+elem_set (elem_type *e, elem_type mask, bool value)
+{
+  /* See bitmap_mark() and bitmap_reset(). */
+  if (value)
+    asm ("orl %1, %0" : "+m" (*e) : "r" (mask) : "cc");
+  else
+    asm ("andl %1, %0" : "+m" (*e) : "r" (~mask) : "cc");
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -213,18 +261,29 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Whole elements are stored at once; the partial elements at
+   either end are updated atomically. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  size_t end = start + cnt;
   size_t i;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  if (cnt == 0)
+    return;
+  for (i = elem_idx (start); i <= elem_idx (end - 1); i++)
+    {
+      elem_type mask = range_mask (i, start, end);
+      if (mask == (elem_type) -1)
+        b->bits[i] = value ? mask : 0;
+      else
+        elem_set (&b->bits[i], mask, value);
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,17 +291,19 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t end = start + cnt;
+  size_t i, true_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
-  return value_cnt;
+  if (cnt == 0)
+    return 0;
+  true_cnt = 0;
+  for (i = elem_idx (start); i <= elem_idx (end - 1); i++)
+    true_cnt += popcount (b->bits[i] & range_mask (i, start, end));
+  return value ? true_cnt : cnt - true_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -250,15 +311,21 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  size_t end = start + cnt;
   size_t i;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
+  if (cnt == 0)
+    return false;
+  for (i = elem_idx (start); i <= elem_idx (end - 1); i++)
+    {
+      elem_type x = value ? b->bits[i] : ~b->bits[i];
+      if ((x & range_mask (i, start, end)) != 0)
+        return true;
+    }
   return false;
 }
 
@@ -291,20 +358,70 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Works an element at a time, tracking the run of VALUE bits
+   that ends at the current position.  An element whose bits are
+   all VALUE extends the run and one with no VALUE bits ends it,
+   without looking at individual bits.  Otherwise, the runs within
+   the element are found with bit scans rather than bit by bit. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  size_t run_start = 0, run_len = 0;
+  size_t i;
+
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  if (cnt == 0)
+    return start;
+  if (cnt > b->bit_cnt - start)
+    return BITMAP_ERROR;
+
+  for (i = elem_idx (start); i < elem_cnt (b->bit_cnt); i++)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      /* X has a 1 for each bit that is VALUE and in range. */
+      elem_type x = value ? b->bits[i] : ~b->bits[i];
+      size_t bit = 0;
+
+      x &= range_mask (i, start, b->bit_cnt);
+      if (x == (elem_type) -1)
+        {
+          if (run_len == 0)
+            run_start = i * ELEM_BITS;
+          run_len += ELEM_BITS;
+          if (run_len >= cnt)
+            return run_start;
+          continue;
+        }
+
+      while (x != 0)
+        {
+          /* Skip to the next 1, ending any run in progress, then
+             measure the 1s that follow.  The 0s shifted in at the
+             top of X mean that ones stops at the end of the
+             element. */
+          size_t zeros = ctz (x);
+          size_t ones;
+
+          if (zeros > 0)
+            {
+              run_len = 0;
+              bit += zeros;
+              x >>= zeros;
+            }
+          ones = ctz (~x);
+          if (run_len == 0)
+            run_start = i * ELEM_BITS + bit;
+          run_len += ones;
+          if (run_len >= cnt)
+            return run_start;
+          bit += ones;
+          x = ones < ELEM_BITS ? x >> ones : 0;
+        }
+      if (bit < ELEM_BITS)
+        run_len = 0;
     }
   return BITMAP_ERROR;
 }
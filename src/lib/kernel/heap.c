@@ -0,0 +1,186 @@
+/* Priority queue.
+
+   See heap.h for basic information. */
+
+#include "heap.h"
+#include "../debug.h"
+
+static struct heap_elem *link (struct heap *,
+                               struct heap_elem *, struct heap_elem *);
+static struct heap_elem *merge_pairs (struct heap *, struct heap_elem *);
+
+/* Initializes heap H as an empty heap ordered by LESS, given
+   auxiliary data AUX. */
+void
+heap_init (struct heap *h, heap_less_func *less, void *aux)
+{
+  ASSERT (h != NULL);
+  ASSERT (less != NULL);
+
+  h->root = NULL;
+  h->size = 0;
+  h->less = less;
+  h->aux = aux;
+}
+
+/* Inserts E into heap H. */
+void
+heap_insert (struct heap *h, struct heap_elem *e)
+{
+  ASSERT (h != NULL);
+  ASSERT (e != NULL);
+
+  e->child = e->next = e->prev = NULL;
+  h->root = link (h, h->root, e);
+  h->size++;
+}
+
+/* Returns a greatest element in heap H, or a null pointer if H
+   is empty. */
+struct heap_elem *
+heap_top (const struct heap *h)
+{
+  ASSERT (h != NULL);
+
+  return h->root;
+}
+
+/* Removes and returns a greatest element in heap H, which must
+   not be empty. */
+struct heap_elem *
+heap_pop (struct heap *h)
+{
+  struct heap_elem *top;
+
+  ASSERT (h != NULL);
+  ASSERT (!heap_empty (h));
+
+  top = h->root;
+  h->root = merge_pairs (h, top->child);
+  if (h->root != NULL)
+    h->root->prev = NULL;
+  h->size--;
+
+  top->child = NULL;
+  return top;
+}
+
+/* Removes E, which must be in heap H, from H. */
+void
+heap_remove (struct heap *h, struct heap_elem *e)
+{
+  struct heap_elem *subtree;
+
+  ASSERT (h != NULL);
+  ASSERT (e != NULL);
+
+  if (e == h->root)
+    {
+      heap_pop (h);
+      return;
+    }
+
+  /* Cut E and its subtree out of its parent's list of children. */
+  ASSERT (e->prev != NULL);
+  if (e->prev->child == e)
+    e->prev->child = e->next;
+  else
+    e->prev->next = e->next;
+  if (e->next != NULL)
+    e->next->prev = e->prev;
+
+  /* Merge E's children back in without E. */
+  subtree = merge_pairs (h, e->child);
+  if (subtree != NULL)
+    subtree->prev = NULL;
+  h->root = link (h, h->root, subtree);
+  h->size--;
+
+  e->child = e->next = e->prev = NULL;
+}
+
+/* Returns the number of elements in heap H. */
+size_t
+heap_size (const struct heap *h)
+{
+  ASSERT (h != NULL);
+
+  return h->size;
+}
+
+/* Returns true if heap H is empty, false otherwise. */
+bool
+heap_empty (const struct heap *h)
+{
+  ASSERT (h != NULL);
+
+  return h->root == NULL;
+}
+
+/* Joins the trees rooted at A and B, either of which may be
+   null, by making the lesser root the first child of the other,
+   and returns the new root.  A and B must not have siblings. */
+static struct heap_elem *
+link (struct heap *h, struct heap_elem *a, struct heap_elem *b)
+{
+  struct heap_elem *tmp;
+
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+
+  if (h->less (a, b, h->aux))
+    {
+      tmp = a;
+      a = b;
+      b = tmp;
+    }
+
+  b->prev = a;
+  b->next = a->child;
+  if (a->child != NULL)
+    a->child->prev = b;
+  a->child = b;
+  a->next = a->prev = NULL;
+  return a;
+}
+
+/* Joins the list of sibling trees that starts at FIRST into a
+   single tree and returns its root, or a null pointer if FIRST
+   is null.  Uses the standard two passes: pair up neighbors
+   from left to right, then link the pairs from right to left.
+   Iterative, so that kernel stack use stays constant. */
+static struct heap_elem *
+merge_pairs (struct heap *h, struct heap_elem *first)
+{
+  struct heap_elem *pairs = NULL;       /* Linked through `next',
+                                           rightmost pair first. */
+  struct heap_elem *root = NULL;
+
+  while (first != NULL)
+    {
+      struct heap_elem *a = first;
+      struct heap_elem *b = a->next;
+      struct heap_elem *pair;
+
+      first = b != NULL ? b->next : NULL;
+      a->next = a->prev = NULL;
+      if (b != NULL)
+        b->next = b->prev = NULL;
+
+      pair = link (h, a, b);
+      pair->next = pairs;
+      pairs = pair;
+    }
+
+  while (pairs != NULL)
+    {
+      struct heap_elem *pair = pairs;
+      pairs = pair->next;
+      pair->next = NULL;
+      root = link (h, root, pair);
+    }
+
+  return root;
+}
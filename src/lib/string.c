@@ -1,5 +1,29 @@
 #include <string.h>
 #include <debug.h>
+#include <stdint.h>
+
+/* The memory functions below move 32-bit words where they can,
+   using the x86 string instructions, and fall back to bytes only
+   for the ends of a block.  Unaligned word accesses are legal on
+   x86, but aligning the destination first makes `rep movsl' and
+   `rep stosl' run at full speed.
+
+   There is no SSE version, because the kernel does not save FPU
+   state on entry.  The direction flag is clear on entry to every
+   function, per the ABI, and intr_entry clears it for interrupt
+   handlers too. */
+
+/* A 32-bit word that may alias any other type. */
+typedef uint32_t word_t __attribute__ ((may_alias));
+
+/* Returns the number of bytes from P to the next word boundary,
+   or SIZE if that is smaller. */
+static inline size_t
+bytes_to_align (const void *p, size_t size)
+{
+  size_t n = -(uintptr_t) p & (sizeof (word_t) - 1);
+  return n < size ? n : size;
+}
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -8,12 +32,20 @@ memcpy (void *dst_, const void *src_, size_t size)
 {
   unsigned char *dst = dst_;
   const unsigned char *src = src_;
+  size_t head, words, tail;
 
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  while (size-- > 0)
-    *dst++ = *src++;
+  head = bytes_to_align (dst, size);
+  words = (size - head) / sizeof (word_t);
+  tail = (size - head) % sizeof (word_t);
+  asm volatile ("rep movsb" : "+D" (dst), "+S" (src), "+c" (head)
+                : : "memory");
+  asm volatile ("rep movsl" : "+D" (dst), "+S" (src), "+c" (words)
+                : : "memory");
+  asm volatile ("rep movsb" : "+D" (dst), "+S" (src), "+c" (tail)
+                : : "memory");
 
   return dst_;
 }
@@ -29,20 +61,29 @@ memmove (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  if (dst < src) 
-    {
-      while (size-- > 0)
-        *dst++ = *src++;
-    }
-  else 
+  if (dst <= src || dst >= src + size)
+    return memcpy (dst_, src_, size);
+  else
     {
-      dst += size;
-      src += size;
-      while (size-- > 0)
-        *--dst = *--src;
+      /* Copy backward, from the last byte: first the bytes that
+         do not make up a whole word, then the words. */
+      size_t tail = size % sizeof (word_t);
+      size_t words = size / sizeof (word_t);
+
+      dst += size - 1;
+      src += size - 1;
+      asm volatile ("std\n\t"
+                    "rep movsb\n\t"
+                    "subl $3, %%esi\n\t"
+                    "subl $3, %%edi\n\t"
+                    "movl %3, %%ecx\n\t"
+                    "rep movsl\n\t"
+                    "cld"
+                    : "+D" (dst), "+S" (src), "+c" (tail)
+                    : "r" (words) : "memory", "cc");
     }
 
-  return dst;
+  return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -58,6 +99,14 @@ memcmp (const void *a_, const void *b_, size_t size)
   ASSERT (a != NULL || size == 0);
   ASSERT (b != NULL || size == 0);
 
+  /* Skip over equal words, then find the differing byte. */
+  for (; size >= sizeof (word_t); size -= sizeof (word_t))
+    {
+      if (*(const word_t *) a != *(const word_t *) b)
+        break;
+      a += sizeof (word_t);
+      b += sizeof (word_t);
+    }
   for (; size-- > 0; a++, b++)
     if (*a != *b)
       return *a > *b ? +1 : -1;
@@ -279,11 +328,20 @@ void *
 memset (void *dst_, int value, size_t size) 
 {
   unsigned char *dst = dst_;
+  word_t fill = (unsigned char) value * (word_t) 0x01010101;
+  size_t head, words, tail;
 
   ASSERT (dst != NULL || size == 0);
-  
-  while (size-- > 0)
-    *dst++ = value;
+
+  head = bytes_to_align (dst, size);
+  words = (size - head) / sizeof (word_t);
+  tail = (size - head) % sizeof (word_t);
+  asm volatile ("rep stosb" : "+D" (dst), "+c" (head) : "a" (fill)
+                : "memory");
+  asm volatile ("rep stosl" : "+D" (dst), "+c" (words) : "a" (fill)
+                : "memory");
+  asm volatile ("rep stosb" : "+D" (dst), "+c" (tail) : "a" (fill)
+                : "memory");
 
   return dst_;
 }
@@ -293,10 +351,25 @@ size_t
 strlen (const char *string) 
 {
   const char *p;
+  const word_t *w;
 
   ASSERT (string != NULL);
 
-  for (p = string; *p != '\0'; p++)
+  /* Check bytes up to a word boundary. */
+  for (p = string; (uintptr_t) p % sizeof (word_t) != 0; p++)
+    if (*p == '\0')
+      return p - string;
+
+  /* Then check a word at a time.  (W - 0x01010101) & ~W has the
+     top bit of a byte set only if some byte of W is zero, and an
+     aligned word never crosses into the next page, so reading
+     past the terminator is safe. */
+  for (w = (const word_t *) p;
+       ((*w - 0x01010101) & ~*w & 0x80808080) == 0; w++)
+    continue;
+
+  /* Find the zero byte within the word. */
+  for (p = (const char *) w; *p != '\0'; p++)
     continue;
   return p - string;
 }
@@ -0,0 +1,166 @@
+/* Test program and microbenchmark for lib/kernel/bitmap.c.
+
+   Checks bitmap_scan(), bitmap_count(), bitmap_contains(), and
+   bitmap_set_multiple() against straightforward bit-at-a-time
+   versions on random bitmaps, then times bitmap_scan() against
+   the bit-at-a-time scan on a nearly full map and on a
+   fragmented one.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <inttypes.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Maximum number of bits in a bitmap that we will test. */
+#define MAX_BITS 300
+
+/* Number of bits in the benchmark bitmaps, like a kernel pool
+   of 64 MB. */
+#define BENCH_BITS 16384
+
+/* Number of scans per benchmark. */
+#define BENCH_SCANS 100
+
+static size_t slow_scan (const struct bitmap *, size_t start, size_t cnt,
+                         bool value);
+static size_t slow_count (const struct bitmap *, size_t start, size_t cnt,
+                          bool value);
+static void verify (void);
+static void bench (const char *name, const struct bitmap *);
+
+/* Test and time the bitmap implementation. */
+void
+test (void)
+{
+  struct bitmap *b;
+  size_t i;
+
+  verify ();
+
+  b = bitmap_create (BENCH_BITS);
+  ASSERT (b != NULL);
+
+  /* Every page in use but a few at the very end. */
+  bitmap_set_all (b, true);
+  bitmap_set_multiple (b, BENCH_BITS - 8, 8, false);
+  bench ("full", b);
+
+  /* Three pages in four in use, at random. */
+  for (i = 0; i < BENCH_BITS; i++)
+    bitmap_set (b, i, random_ulong () % 4 != 0);
+  bench ("fragmented", b);
+
+  bitmap_destroy (b);
+  printf ("bitmap: PASS\n");
+}
+
+/* Checks the bitmap functions against the slow versions on
+   random bitmaps of random sizes and densities. */
+static void
+verify (void)
+{
+  int repeat;
+
+  printf ("testing random bitmaps:");
+  for (repeat = 0; repeat < 10000; repeat++)
+    {
+      size_t bit_cnt = 1 + random_ulong () % MAX_BITS;
+      struct bitmap *b = bitmap_create (bit_cnt);
+      unsigned density = random_ulong () % 101;
+      size_t start, cnt, i;
+      bool value;
+
+      ASSERT (b != NULL);
+      for (i = 0; i < bit_cnt; i++)
+        bitmap_set (b, i, random_ulong () % 100 < density);
+
+      start = random_ulong () % (bit_cnt + 1);
+      value = random_ulong () % 2;
+
+      cnt = random_ulong () % (bit_cnt + 2);
+      ASSERT (bitmap_scan (b, start, cnt, value)
+              == slow_scan (b, start, cnt, value));
+
+      cnt = random_ulong () % (bit_cnt - start + 1);
+      ASSERT (bitmap_count (b, start, cnt, value)
+              == slow_count (b, start, cnt, value));
+      ASSERT (bitmap_contains (b, start, cnt, value)
+              == (slow_count (b, start, cnt, value) > 0));
+
+      bitmap_set_multiple (b, start, cnt, value);
+      ASSERT (slow_count (b, start, cnt, value) == cnt);
+
+      bitmap_destroy (b);
+      if (repeat % 1000 == 0)
+        printf (" %d", repeat);
+    }
+  printf (" done\n");
+}
+
+/* Times BENCH_SCANS scans of B for 4 free bits, first with
+   bitmap_scan() and then with slow_scan(), and prints the
+   results. */
+static void
+bench (const char *name, const struct bitmap *b)
+{
+  int64_t start, fast, slow;
+  size_t fast_idx = 0, slow_idx = 0;
+  int i;
+
+  start = timer_usecs ();
+  for (i = 0; i < BENCH_SCANS; i++)
+    fast_idx = bitmap_scan (b, 0, 4, false);
+  fast = timer_usecs () - start;
+
+  start = timer_usecs ();
+  for (i = 0; i < BENCH_SCANS; i++)
+    slow_idx = slow_scan (b, 0, 4, false);
+  slow = timer_usecs () - start;
+
+  ASSERT (fast_idx == slow_idx);
+  printf ("%s: %d scans in %"PRId64" us, bit at a time %"PRId64" us\n",
+          name, BENCH_SCANS, fast, slow);
+}
+
+/* Returns the index of the first group of CNT bits in B at or
+   after START that are all VALUE, or BITMAP_ERROR, testing one
+   bit at a time.  This is how bitmap_scan() used to work. */
+static size_t
+slow_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i, j;
+
+  if (cnt > bitmap_size (b))
+    return BITMAP_ERROR;
+  for (i = start; i + cnt <= bitmap_size (b); i++)
+    {
+      for (j = 0; j < cnt; j++)
+        if (bitmap_test (b, i + j) != value)
+          break;
+      if (j == cnt)
+        return i;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Returns the number of bits in B between START and START + CNT,
+   exclusive, that are VALUE, testing one bit at a time. */
+static size_t
+slow_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t value_cnt = 0;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      value_cnt++;
+  return value_cnt;
+}
@@ -0,0 +1,151 @@
+/* Test program and microbenchmark for the memory functions in
+   lib/string.c.
+
+   Checks memcpy(), memmove(), memset(), memcmp(), and strlen()
+   against byte-at-a-time versions at random sizes, alignments,
+   and overlaps, then times zeroing a page and copying a sector
+   with each.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <inttypes.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+#include "threads/vaddr.h"
+
+/* Size of the buffers that tests work within. */
+#define BUF_SIZE 8192
+
+/* Number of repetitions per benchmark. */
+#define BENCH_CNT 10000
+
+static uint8_t a[BUF_SIZE], b[BUF_SIZE], c[BUF_SIZE];
+static uint8_t page[PGSIZE] __attribute__ ((aligned (PGSIZE)));
+
+static void verify (void);
+static void slow_copy (volatile uint8_t *, const uint8_t *, size_t);
+static void slow_set (volatile uint8_t *, int, size_t);
+
+/* Test and time the memory functions. */
+void
+test (void)
+{
+  int64_t start, fast, slow;
+  int i;
+
+  verify ();
+
+  start = timer_usecs ();
+  for (i = 0; i < BENCH_CNT; i++)
+    memset (page, 0, PGSIZE);
+  fast = timer_usecs () - start;
+  start = timer_usecs ();
+  for (i = 0; i < BENCH_CNT; i++)
+    slow_set (page, 0, PGSIZE);
+  slow = timer_usecs () - start;
+  printf ("page zero: %d in %"PRId64" us, byte at a time %"PRId64" us\n",
+          BENCH_CNT, fast, slow);
+
+  start = timer_usecs ();
+  for (i = 0; i < BENCH_CNT; i++)
+    memcpy (b, a, 512);
+  fast = timer_usecs () - start;
+  start = timer_usecs ();
+  for (i = 0; i < BENCH_CNT; i++)
+    slow_copy (b, a, 512);
+  slow = timer_usecs () - start;
+  printf ("512-byte copy: %d in %"PRId64" us, byte at a time %"PRId64" us\n",
+          BENCH_CNT, fast, slow);
+
+  printf ("string: PASS\n");
+}
+
+/* Checks the memory functions against the slow versions, using C
+   as the expected contents of B. */
+static void
+verify (void)
+{
+  int repeat;
+
+  printf ("testing memory functions:");
+  for (repeat = 0; repeat < 20000; repeat++)
+    {
+      size_t size = random_ulong () % (repeat % 10 == 0 ? 4000 : 70);
+      size_t src = random_ulong () % 40;
+      size_t dst = BUF_SIZE / 2 + random_ulong () % 40;
+      size_t i;
+
+      random_bytes (a, sizeof a);
+      memcpy (b, a, sizeof b);
+      slow_copy (c, a, sizeof c);
+
+      switch (random_ulong () % 5)
+        {
+        case 0:
+          ASSERT (memcpy (b + dst, b + src, size) == b + dst);
+          slow_copy (c + dst, c + src, size);
+          break;
+
+        case 1:
+          /* Overlapping in either direction. */
+          src = 100 + src;
+          dst = src + random_ulong () % 9 - 4;
+          ASSERT (memmove (b + dst, b + src, size) == b + dst);
+          slow_copy (a, c + src, size);
+          slow_copy (c + dst, a, size);
+          break;
+
+        case 2:
+          ASSERT (memset (b + dst, repeat, size) == b + dst);
+          slow_set (c + dst, repeat, size);
+          break;
+
+        case 3:
+          slow_copy (b + dst, b + src, size);
+          if (size > 0 && random_ulong () % 2)
+            b[dst + random_ulong () % size] ^= 0x80;
+          for (i = 0; i < size && b[src + i] == b[dst + i]; i++)
+            continue;
+          ASSERT (memcmp (b + src, b + dst, size)
+                  == (i == size ? 0 : b[src + i] > b[dst + i] ? 1 : -1));
+          continue;
+
+        case 4:
+          for (i = 0; i < size; i++)
+            b[src + i] |= 1;
+          b[src + size] = '\0';
+          ASSERT (strlen ((char *) b + src) == size);
+          continue;
+        }
+      ASSERT (!memcmp (b, c, sizeof b));
+
+      if (repeat % 2000 == 0)
+        printf (" %d", repeat);
+    }
+  printf (" done\n");
+}
+
+/* Copies SIZE bytes from SRC to DST one at a time.  DST is
+   volatile so that the compiler cannot turn this into a call to
+   memcpy(). */
+static void
+slow_copy (volatile uint8_t *dst, const uint8_t *src, size_t size)
+{
+  while (size-- > 0)
+    *dst++ = *src++;
+}
+
+/* Sets SIZE bytes at DST to VALUE one at a time. */
+static void
+slow_set (volatile uint8_t *dst, int value, size_t size)
+{
+  while (size-- > 0)
+    *dst++ = value;
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(alarm-priority-tickless) begin
+(alarm-priority-tickless) Thread priority 30 woke up.
+(alarm-priority-tickless) Thread priority 29 woke up.
+(alarm-priority-tickless) Thread priority 28 woke up.
+(alarm-priority-tickless) Thread priority 27 woke up.
+(alarm-priority-tickless) Thread priority 26 woke up.
+(alarm-priority-tickless) Thread priority 25 woke up.
+(alarm-priority-tickless) Thread priority 24 woke up.
+(alarm-priority-tickless) Thread priority 23 woke up.
+(alarm-priority-tickless) Thread priority 22 woke up.
+(alarm-priority-tickless) Thread priority 21 woke up.
+(alarm-priority-tickless) end
+EOF
+pass;
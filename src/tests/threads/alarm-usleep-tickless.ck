@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(alarm-usleep-tickless) begin
+(alarm-usleep-tickless) Creating 5 threads to sleep for less than a tick.
+(alarm-usleep-tickless) Thread 0 sleeps longest, thread 4 shortest.
+(alarm-usleep-tickless) thread 4 woke up.
+(alarm-usleep-tickless) thread 3 woke up.
+(alarm-usleep-tickless) thread 2 woke up.
+(alarm-usleep-tickless) thread 1 woke up.
+(alarm-usleep-tickless) thread 0 woke up.
+(alarm-usleep-tickless) end
+EOF
+pass;
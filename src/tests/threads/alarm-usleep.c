@@ -0,0 +1,104 @@
+/* Creates several threads that each sleep a different number of
+   microseconds, all less than one timer tick, starting at the
+   same tick.  Verifies that they wake up in order of their sleep
+   durations and that none of them wakes up early. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define THREAD_CNT 5
+
+/* Information about the test. */
+struct usleep_test
+  {
+    int64_t start;              /* Tick at which all threads sleep. */
+    struct lock output_lock;    /* Lock protecting output buffer. */
+    int output[THREAD_CNT];     /* Thread IDs in wakeup order. */
+    int output_cnt;             /* Number of threads woken up. */
+    bool early[THREAD_CNT];     /* Whether each thread woke early. */
+  };
+
+/* Information about an individual thread in the test. */
+struct usleep_thread
+  {
+    struct usleep_test *test;   /* Info shared between all threads. */
+    int id;                     /* Sleeper ID. */
+    int64_t duration;           /* Microseconds to sleep. */
+  };
+
+static thread_func usleeper;
+
+void
+test_alarm_usleep (void)
+{
+  struct usleep_test test;
+  struct usleep_thread threads[THREAD_CNT];
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  msg ("Creating %d threads to sleep for less than a tick.", THREAD_CNT);
+  msg ("Thread 0 sleeps longest, thread %d shortest.", THREAD_CNT - 1);
+
+  test.start = timer_ticks () + 10;
+  lock_init (&test.output_lock);
+  test.output_cnt = 0;
+
+  /* Give the sleepers durations in reverse order of creation, so
+     that waking them up in any other order than by deadline
+     shows up in the output. */
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      struct usleep_thread *t = threads + i;
+      char name[16];
+
+      t->test = &test;
+      t->id = i;
+      t->duration = (THREAD_CNT - i) * (1000000 / TIMER_FREQ)
+                    / (THREAD_CNT + 1);
+      test.early[i] = false;
+
+      snprintf (name, sizeof name, "thread %d", i);
+      thread_create (name, PRI_DEFAULT, usleeper, t);
+    }
+
+  /* Wait long enough for all the threads to finish. */
+  timer_sleep (10 + 10);
+
+  lock_acquire (&test.output_lock);
+  if (test.output_cnt != THREAD_CNT)
+    fail ("%d threads woke up instead of %d", test.output_cnt, THREAD_CNT);
+  for (i = 0; i < test.output_cnt; i++)
+    {
+      int id = test.output[i];
+      msg ("thread %d woke up.", id);
+      if (test.early[id])
+        fail ("thread %d woke up before its %"PRId64" us were up",
+              id, threads[id].duration);
+    }
+  lock_release (&test.output_lock);
+}
+
+/* Sleeper thread. */
+static void
+usleeper (void *t_)
+{
+  struct usleep_thread *t = t_;
+  struct usleep_test *test = t->test;
+  int64_t before;
+
+  timer_sleep (test->start - timer_ticks ());
+
+  before = timer_usecs ();
+  timer_usleep (t->duration);
+  lock_acquire (&test->output_lock);
+  test->early[t->id] = timer_usecs () - before < t->duration;
+  test->output[test->output_cnt++] = t->id;
+  lock_release (&test->output_lock);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(alarm-usleep) begin
+(alarm-usleep) Creating 5 threads to sleep for less than a tick.
+(alarm-usleep) Thread 0 sleeps longest, thread 4 shortest.
+(alarm-usleep) thread 4 woke up.
+(alarm-usleep) thread 3 woke up.
+(alarm-usleep) thread 2 woke up.
+(alarm-usleep) thread 1 woke up.
+(alarm-usleep) thread 0 woke up.
+(alarm-usleep) end
+EOF
+pass;
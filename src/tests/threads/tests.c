@@ -17,6 +17,12 @@ static const struct test tests[] =
     {"alarm-priority", test_alarm_priority},
     {"alarm-zero", test_alarm_zero},
     {"alarm-negative", test_alarm_negative},
+    {"alarm-usleep", test_alarm_usleep},
+    {"alarm-single-tickless", test_alarm_single},
+    {"alarm-multiple-tickless", test_alarm_multiple},
+    {"alarm-simultaneous-tickless", test_alarm_simultaneous},
+    {"alarm-priority-tickless", test_alarm_priority},
+    {"alarm-usleep-tickless", test_alarm_usleep},
     {"priority-change", test_priority_change},
     {"priority-donate-one", test_priority_donate_one},
     {"priority-donate-multiple", test_priority_donate_multiple},
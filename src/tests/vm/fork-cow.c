@@ -0,0 +1,61 @@
+/* Forks a child, then the child and the parent each write to a
+   different page of a buffer that they share copy-on-write.
+   Verifies that each process sees only its own write, and that
+   the pages that neither one wrote still hold their original
+   contents in both. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 8
+
+static char buf[PAGE_CNT][PAGE_SIZE];
+
+/* Checks that page 0 of buf is filled with P0, page 1 with P1,
+   and every other page I with 'a' + I. */
+static void
+check_pages (char p0, char p1)
+{
+  size_t i, j;
+
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      char expected = i == 0 ? p0 : i == 1 ? p1 : 'a' + (int) i;
+
+      for (j = 0; j < PAGE_SIZE; j++)
+        if (buf[i][j] != expected)
+          fail ("byte %zu of page %zu is '%c' instead of '%c'",
+                j, i, buf[i][j], expected);
+    }
+}
+
+void
+test_main (void)
+{
+  pid_t child;
+  size_t i;
+
+  for (i = 0; i < PAGE_CNT; i++)
+    memset (buf[i], 'a' + (int) i, PAGE_SIZE);
+
+  child = fork ();
+  if (child == 0)
+    {
+      memset (buf[0], 'X', PAGE_SIZE);
+      check_pages ('X', 'b');
+      msg ("child's copy is correct");
+      exit (81);
+    }
+  if (child == PID_ERROR)
+    fail ("fork");
+
+  /* Write before the child exits, while the page may still be
+     shared, and print nothing until the child is done. */
+  memset (buf[1], 'Y', PAGE_SIZE);
+  CHECK (wait (child) == 81, "wait for child");
+  check_pages ('a', 'Y');
+  msg ("parent's copy is correct");
+}
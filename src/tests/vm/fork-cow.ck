@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-cow) begin
+(fork-cow) child's copy is correct
+(fork-cow) wait for child
+(fork-cow) parent's copy is correct
+(fork-cow) end
+EOF
+pass;
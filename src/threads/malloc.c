@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -28,12 +29,30 @@
    blocks, we remove all of the arena's blocks from the free list
    and give the arena back to the page allocator.
 
+   In front of each descriptor's free list sits a "magazine": a
+   small stack of free blocks that malloc() and free() use with
+   nothing more than interrupts disabled.  Only when a
+   magazine runs empty, or fills up, do we take the descriptor's
+   lock and move a batch of blocks between it and the free list.
+
    We can't handle blocks bigger than 2 kB using this scheme,
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
    the beginning of the allocated block's arena header. */
 
+/* Capacity of a magazine, and number of blocks moved between a
+   magazine and its descriptor's free list at a time. */
+#define MAG_SIZE 16
+#define MAG_BATCH (MAG_SIZE / 2)
+
+/* Cache of free blocks.  Accessed only with interrupts off. */
+struct magazine
+  {
+    size_t cnt;                         /* Number of blocks. */
+    struct block *rounds[MAG_SIZE];     /* Blocks, top at CNT - 1. */
+  };
+
 /* Descriptor. */
 struct desc
   {
@@ -41,6 +60,7 @@ struct desc
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+    struct magazine mag;        /* Cache of free blocks. */
   };
 
 /* Magic number for detecting arena corruption. */
@@ -66,6 +86,8 @@ static size_t desc_cnt;         /* Number of descriptors. */
 
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static size_t get_blocks (struct desc *, struct block **, size_t cnt);
+static void put_blocks (struct desc *, struct block **, size_t cnt);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -81,6 +103,7 @@ malloc_init (void)
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
       lock_init (&d->lock);
+      d->mag.cnt = 0;
     }
 }
 
@@ -90,8 +113,11 @@ void *
 malloc (size_t size) 
 {
   struct desc *d;
-  struct block *b;
+  struct block *batch[MAG_BATCH];
+  struct magazine *m;
   struct arena *a;
+  enum intr_level old_level;
+  size_t cnt;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
@@ -119,19 +145,57 @@ malloc (size_t size)
       return a + 1;
     }
 
+  /* Take a block from the magazine, if it has one. */
+  old_level = intr_disable ();
+  m = &d->mag;
+  if (m->cnt > 0)
+    {
+      struct block *b = m->rounds[--m->cnt];
+      intr_set_level (old_level);
+      return b;
+    }
+  intr_set_level (old_level);
+
+  /* Refill the magazine with a batch from the free list, keeping
+     one block to return.  Another thread may have refilled it
+     while we held the lock, in which case the blocks that do not
+     fit go back. */
+  cnt = get_blocks (d, batch, MAG_BATCH);
+  if (cnt == 0)
+    return NULL;
+  cnt--;
+  old_level = intr_disable ();
+  m = &d->mag;
+  while (cnt > 0 && m->cnt < MAG_SIZE)
+    m->rounds[m->cnt++] = batch[cnt--];
+  intr_set_level (old_level);
+  if (cnt > 0)
+    put_blocks (d, batch + 1, cnt);
+  return batch[0];
+}
+
+/* Takes up to CNT blocks from D's free list, creating an arena if
+   the list is empty, and stores them in BLOCKS.  Returns the
+   number of blocks taken, which is 0 only if no memory is
+   available. */
+static size_t
+get_blocks (struct desc *d, struct block **blocks, size_t cnt)
+{
+  size_t i;
+
   lock_acquire (&d->lock);
 
   /* If the free list is empty, create a new arena. */
   if (list_empty (&d->free_list))
     {
-      size_t i;
+      struct arena *a;
 
       /* Allocate a page. */
       a = palloc_get_page (0);
       if (a == NULL) 
         {
           lock_release (&d->lock);
-          return NULL; 
+          return 0;
         }
 
       /* Initialize arena and add its blocks to the free list. */
@@ -145,12 +209,16 @@ malloc (size_t size)
         }
     }
 
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
+  /* Get blocks from the free list. */
+  for (i = 0; i < cnt && !list_empty (&d->free_list); i++)
+    {
+      struct block *b = list_entry (list_pop_front (&d->free_list),
+                                    struct block, free_elem);
+      block_to_arena (b)->free_cnt--;
+      blocks[i] = b;
+    }
   lock_release (&d->lock);
-  return b;
+  return i;
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -227,32 +295,33 @@ free (void *p)
       if (d != NULL) 
         {
           /* It's a normal block.  We handle it here. */
+          struct block *batch[MAG_BATCH];
+          struct magazine *m;
+          enum intr_level old_level;
 
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
-  
-          lock_acquire (&d->lock);
 
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
-
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
+          /* Put the block in the magazine.  If it is full,
+             move its oldest half to the free list first. */
+          old_level = intr_disable ();
+          m = &d->mag;
+          if (m->cnt < MAG_SIZE)
             {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
+              m->rounds[m->cnt++] = b;
+              intr_set_level (old_level);
+              return;
             }
-
-          lock_release (&d->lock);
+          memcpy (batch, m->rounds, sizeof batch);
+          memmove (m->rounds, m->rounds + MAG_BATCH,
+                   (MAG_SIZE - MAG_BATCH) * sizeof *m->rounds);
+          m->cnt -= MAG_BATCH;
+          m->rounds[m->cnt++] = b;
+          intr_set_level (old_level);
+
+          put_blocks (d, batch, MAG_BATCH);
         }
       else
         {
@@ -263,6 +332,40 @@ free (void *p)
     }
 }
 
+/* Returns the CNT blocks in BLOCKS to D's free list, giving back
+   to the page allocator any arena that is left entirely
+   unused. */
+static void
+put_blocks (struct desc *d, struct block **blocks, size_t cnt)
+{
+  size_t i;
+
+  lock_acquire (&d->lock);
+  for (i = 0; i < cnt; i++)
+    {
+      struct block *b = blocks[i];
+      struct arena *a = block_to_arena (b);
+
+      /* Add block to free list. */
+      list_push_front (&d->free_list, &b->free_elem);
+
+      /* If the arena is now entirely unused, free it. */
+      if (++a->free_cnt >= d->blocks_per_arena) 
+        {
+          size_t j;
+
+          ASSERT (a->free_cnt == d->blocks_per_arena);
+          for (j = 0; j < d->blocks_per_arena; j++) 
+            {
+              struct block *b = arena_to_block (a, j);
+              list_remove (&b->free_elem);
+            }
+          palloc_free_page (a);
+        }
+    }
+  lock_release (&d->lock);
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
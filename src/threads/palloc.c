@@ -2,6 +2,7 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -23,13 +24,38 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is managed as a binary buddy system.  Free memory is
+   kept as blocks of 2**K pages, for "order" K, each aligned to a
+   multiple of its size relative to the pool's base, on one free
+   list per order.  An allocation takes a block from the smallest
+   nonempty list that is big enough, splitting it in halves as
+   needed, and returns any pages beyond those requested.  Freeing
+   a block merges it with its "buddy", the other half of the
+   block it was split from, for as long as the buddy is free.
+   Both take O(log n) time.  A free block's list element is
+   stored in its first page, so the only other memory needed is
+   one byte per page. */
+
+/* Number of block orders.  The biggest block is 2**(ORDER_CNT - 1)
+   pages, or 2 GB. */
+#define ORDER_CNT 20
+
+/* Flag in a page's `orders' entry marking the first page of a
+   free block.  The low bits hold the block's order. */
+#define ORDER_FREE 0x80
 
 /* A memory pool. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
+    struct spinlock lock;               /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
+    uint8_t *orders;                    /* Per-page free block order. */
+    struct list free_lists[ORDER_CNT];  /* Free blocks by order. */
+    uint32_t free_mask;                 /* Bit K set iff free_lists[K]
+                                           is nonempty. */
+    size_t page_cnt;                    /* Number of pages. */
     uint8_t *base;                      /* Base of pool. */
   };
 
@@ -39,6 +65,10 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t alloc_pages (struct pool *, size_t page_cnt);
+static void free_pages (struct pool *, size_t page_idx, size_t page_cnt);
+static void free_block (struct pool *, size_t page_idx, int order);
+static struct list_elem *block_elem (const struct pool *, size_t page_idx);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -77,9 +107,9 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  spinlock_acquire (&pool->lock);
+  page_idx = alloc_pages (pool, page_cnt);
+  spinlock_release (&pool->lock);
 
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
@@ -137,8 +167,10 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  spinlock_acquire (&pool->lock);
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  free_pages (pool, page_idx, page_cnt);
+  spinlock_release (&pool->lock);
 }
 
 /* Frees the page at PAGE. */
@@ -153,10 +185,13 @@ palloc_free_page (void *page)
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  /* We'll put the pool's used_map and orders at its base.
+     Calculate the space needed for them and subtract it from the
+     pool's size. */
+  size_t bm_size = ROUND_UP (bitmap_buf_size (page_cnt), sizeof (long));
+  size_t bm_pages = DIV_ROUND_UP (bm_size + page_cnt, PGSIZE);
+  int order;
+
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -164,9 +199,19 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  spinlock_init (&p->lock);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  bitmap_set_all (p->used_map, true);
+  p->orders = (uint8_t *) base + bm_size;
+  memset (p->orders, 0, page_cnt);
+  for (order = 0; order < ORDER_CNT; order++)
+    list_init (&p->free_lists[order]);
+  p->free_mask = 0;
+  p->page_cnt = page_cnt;
   p->base = base + bm_pages * PGSIZE;
+
+  /* Carve the pool into the biggest aligned blocks that fit. */
+  free_pages (p, 0, page_cnt);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -176,7 +221,109 @@ page_from_pool (const struct pool *pool, void *page)
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t end_page = start_page + pool->page_cnt;
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first, or BITMAP_ERROR if no free block is big
+   enough.  POOL's lock must be held. */
+static size_t
+alloc_pages (struct pool *pool, size_t page_cnt)
+{
+  struct list_elem *e;
+  uint32_t mask;
+  size_t page_idx;
+  int want, order;
+
+  /* Smallest order that holds PAGE_CNT pages. */
+  for (want = 0; want < ORDER_CNT && ((size_t) 1 << want) < page_cnt; want++)
+    continue;
+  if (want >= ORDER_CNT)
+    return BITMAP_ERROR;
+
+  /* Take a block from the smallest nonempty free list of at
+     least that order. */
+  mask = pool->free_mask & ~(((uint32_t) 1 << want) - 1);
+  if (mask == 0)
+    return BITMAP_ERROR;
+  order = __builtin_ctz (mask);
+  e = list_pop_front (&pool->free_lists[order]);
+  if (list_empty (&pool->free_lists[order]))
+    pool->free_mask &= ~((uint32_t) 1 << order);
+  page_idx = ((uint8_t *) e - pool->base) / PGSIZE;
+  ASSERT (pool->orders[page_idx] == (ORDER_FREE | order));
+  pool->orders[page_idx] = 0;
+
+  /* Split off and free the upper halves until the block is
+     the size wanted, then give back the pages beyond PAGE_CNT. */
+  while (order > want)
+    {
+      order--;
+      free_block (pool, page_idx + ((size_t) 1 << order), order);
+    }
+  bitmap_set_multiple (pool->used_map, page_idx, (size_t) 1 << want, true);
+  free_pages (pool, page_idx + page_cnt, ((size_t) 1 << want) - page_cnt);
+
+  return page_idx;
+}
+
+/* Frees the PAGE_CNT pages starting at PAGE_IDX in POOL, as the
+   biggest aligned blocks that cover them.  POOL's lock must be
+   held. */
+static void
+free_pages (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  while (page_cnt > 0)
+    {
+      int order = 0;
+
+      while (order + 1 < ORDER_CNT
+             && page_idx % ((size_t) 1 << (order + 1)) == 0
+             && ((size_t) 1 << (order + 1)) <= page_cnt)
+        order++;
+      free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Puts the free block of 2**ORDER pages at PAGE_IDX in POOL on
+   its free list, first merging it with its buddy for as long as
+   the buddy is also free.  POOL's lock must be held. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order)
+{
+  while (order + 1 < ORDER_CNT)
+    {
+      size_t buddy = page_idx ^ ((size_t) 1 << order);
+
+      if (buddy + ((size_t) 1 << order) > pool->page_cnt
+          || pool->orders[buddy] != (ORDER_FREE | order))
+        break;
+      list_remove (block_elem (pool, buddy));
+      if (list_empty (&pool->free_lists[order]))
+        pool->free_mask &= ~((uint32_t) 1 << order);
+      pool->orders[buddy] = 0;
+      if (buddy < page_idx)
+        page_idx = buddy;
+      order++;
+    }
+
+  /* Most recently freed blocks go first, since they are the
+     likeliest to still be in the CPU cache. */
+  pool->orders[page_idx] = ORDER_FREE | order;
+  list_push_front (&pool->free_lists[order], block_elem (pool, page_idx));
+  pool->free_mask |= (uint32_t) 1 << order;
+}
+
+/* Returns the list element stored in the free block at PAGE_IDX
+   in POOL. */
+static struct list_elem *
+block_elem (const struct pool *pool, size_t page_idx)
+{
+  return (struct list_elem *) (pool->base + page_idx * PGSIZE);
+}
+
@@ -0,0 +1,330 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Slab allocator, after Bonwick, "The Slab Allocator: An
+   Object-Caching Kernel Memory Allocator".
+
+   Each slab is one page obtained from the page allocator.  It
+   starts with a struct slab header, followed by a stack of the
+   indexes of the slab's free objects, followed by the objects
+   themselves.  Keeping the free stack outside the objects means
+   that freeing an object never overwrites it, which is what lets
+   constructed state survive.
+
+   Whatever space is left over at the end of a slab is used for
+   "coloring": each new slab starts its objects a little further
+   into the page than the last, in steps of COLOR_STEP bytes, so
+   that the same object in different slabs does not always land
+   on the same cache lines.
+
+   A cache keeps its slabs on three lists, by whether they are
+   partly used, fully used, or entirely free.  Allocation prefers
+   partly used slabs, to keep memory packed.  At most
+   EMPTY_MAX entirely free slabs are kept; beyond that they go
+   back to the page allocator. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Distance between successive slab colors, in bytes: the size of
+   a cache line. */
+#define COLOR_STEP 32
+
+/* Number of empty slabs a cache keeps instead of freeing. */
+#define EMPTY_MAX 1
+
+/* Object cache. */
+struct kmem_cache
+  {
+    struct list_elem elem;      /* Element in all_caches. */
+    char name[16];              /* Name, for statistics. */
+    size_t size;                /* Object size, a multiple of align. */
+    size_t align;               /* Object alignment. */
+    kmem_ctor_func *ctor;       /* Constructor, or null. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    size_t objs_ofs;            /* Offset of first object, uncolored. */
+    size_t color_max;           /* Largest color offset. */
+    size_t color_next;          /* Color offset for next slab. */
+
+    struct lock lock;           /* Protects the members below. */
+    struct list partial;        /* Slabs with free and used objects. */
+    struct list full;           /* Slabs with no free objects. */
+    struct list empty;          /* Slabs with no used objects. */
+    size_t empty_cnt;           /* Number of slabs in empty. */
+
+    /* Statistics. */
+    size_t slab_cnt;            /* Slabs currently held. */
+    size_t in_use;              /* Objects currently allocated. */
+    size_t peak_in_use;         /* Highest value of in_use. */
+    unsigned long long alloc_cnt;       /* Calls to kmem_cache_alloc(). */
+    unsigned long long free_cnt;        /* Calls to kmem_cache_free(). */
+    unsigned long long grow_cnt;        /* Slabs created. */
+    unsigned long long reap_cnt;        /* Slabs freed. */
+  };
+
+/* Slab header, at the start of each slab's page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in one of cache's lists. */
+    uint8_t *objs;              /* First object. */
+    size_t free_cnt;            /* Number of free objects. */
+    uint16_t free[];            /* Indexes of free objects. */
+  };
+
+/* All caches, for statistics. */
+static struct list all_caches = LIST_INITIALIZER (all_caches);
+
+static struct slab *slab_create (struct kmem_cache *);
+static void slab_destroy (struct kmem_cache *, struct slab *);
+static struct slab *obj_to_slab (void *);
+
+/* Creates and returns a cache of objects of SIZE bytes each,
+   aligned on ALIGN-byte boundaries, which must be a power of 2
+   or 0 for the default alignment.  If CTOR is non-null, it is
+   called on each object when its slab is created.  NAME is used
+   only for statistics.  Panics if memory is not available,
+   since caches are created during initialization. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, size_t align,
+                   kmem_ctor_func *ctor)
+{
+  struct kmem_cache *c;
+  enum intr_level old_level;
+  size_t n;
+
+  if (align == 0)
+    align = sizeof (void *);
+  ASSERT ((align & (align - 1)) == 0 && align <= PGSIZE / 4);
+  ASSERT (size > 0);
+
+  c = malloc (sizeof *c);
+  if (c == NULL)
+    PANIC ("%s: cannot allocate object cache", name);
+  strlcpy (c->name, name, sizeof c->name);
+  c->size = ROUND_UP (size, align);
+  c->align = align;
+  c->ctor = ctor;
+
+  /* Fit as many objects, plus their free stack entries, after
+     the header as will go. */
+  n = (PGSIZE - sizeof (struct slab)) / (c->size + sizeof (uint16_t));
+  while (n > 0
+         && ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t), align)
+            + n * c->size > PGSIZE)
+    n--;
+  if (n == 0)
+    PANIC ("%s: %zu-byte objects do not fit in a slab", name, size);
+  c->objs_per_slab = n;
+  c->objs_ofs = ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+                          align);
+  c->color_max = PGSIZE - c->objs_ofs - n * c->size;
+  c->color_max -= c->color_max % (COLOR_STEP > align ? COLOR_STEP : align);
+  c->color_next = 0;
+
+  lock_init (&c->lock);
+  list_init (&c->partial);
+  list_init (&c->full);
+  list_init (&c->empty);
+  c->empty_cnt = 0;
+
+  c->slab_cnt = c->in_use = c->peak_in_use = 0;
+  c->alloc_cnt = c->free_cnt = c->grow_cnt = c->reap_cnt = 0;
+
+  old_level = intr_disable ();
+  list_push_back (&all_caches, &c->elem);
+  intr_set_level (old_level);
+  return c;
+}
+
+/* Allocates and returns an object from cache C.  Returns a null
+   pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  lock_acquire (&c->lock);
+
+  /* Find a slab with a free object, creating one if necessary. */
+  if (!list_empty (&c->partial))
+    s = list_entry (list_front (&c->partial), struct slab, elem);
+  else if (!list_empty (&c->empty))
+    {
+      s = list_entry (list_pop_front (&c->empty), struct slab, elem);
+      c->empty_cnt--;
+      list_push_front (&c->partial, &s->elem);
+    }
+  else
+    {
+      s = slab_create (c);
+      if (s == NULL)
+        {
+          lock_release (&c->lock);
+          return NULL;
+        }
+      list_push_front (&c->partial, &s->elem);
+    }
+
+  /* Take an object. */
+  obj = s->objs + s->free[--s->free_cnt] * c->size;
+  if (s->free_cnt == 0)
+    {
+      list_remove (&s->elem);
+      list_push_front (&c->full, &s->elem);
+    }
+
+  c->alloc_cnt++;
+  if (++c->in_use > c->peak_in_use)
+    c->peak_in_use = c->in_use;
+  lock_release (&c->lock);
+  return obj;
+}
+
+/* Returns OBJ, which must have been allocated from cache C, to
+   C.  If C has a constructor, OBJ must be in its constructed
+   state.  Does nothing if OBJ is null. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+  size_t idx;
+
+  if (obj == NULL)
+    return;
+
+  s = obj_to_slab (obj);
+  ASSERT (s->cache == c);
+  idx = ((uint8_t *) obj - s->objs) / c->size;
+  ASSERT (s->objs + idx * c->size == obj);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs, unless
+     that would destroy its constructed state. */
+  if (c->ctor == NULL)
+    memset (obj, 0xcc, c->size);
+#endif
+
+  lock_acquire (&c->lock);
+  ASSERT (s->free_cnt < c->objs_per_slab);
+  s->free[s->free_cnt++] = idx;
+  if (s->free_cnt == 1 || s->free_cnt == c->objs_per_slab)
+    {
+      /* Move the slab from the full list to the partial list, or
+         from the partial list to the empty list. */
+      list_remove (&s->elem);
+      if (s->free_cnt < c->objs_per_slab)
+        list_push_front (&c->partial, &s->elem);
+      else if (c->empty_cnt < EMPTY_MAX)
+        {
+          list_push_front (&c->empty, &s->elem);
+          c->empty_cnt++;
+        }
+      else
+        slab_destroy (c, s);
+    }
+
+  c->free_cnt++;
+  c->in_use--;
+  lock_release (&c->lock);
+}
+
+/* Prints statistics for each object cache that has been used. */
+void
+kmem_print_stats (void)
+{
+  struct list_elem *e;
+
+  /* The counters are read without locking, since this may be
+     called from a kernel panic. */
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e))
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+
+      if (c->alloc_cnt == 0)
+        continue;
+      printf ("Slab %s: %zu-byte objects, %zu per slab, "
+              "%zu in use (peak %zu), %zu slabs\n",
+              c->name, c->size, c->objs_per_slab,
+              c->in_use, c->peak_in_use, c->slab_cnt);
+      printf ("Slab %s: %llu allocs, %llu frees, "
+              "%llu slabs created, %llu freed\n",
+              c->name, c->alloc_cnt, c->free_cnt,
+              c->grow_cnt, c->reap_cnt);
+    }
+}
+
+/* Creates and returns a new slab for cache C, with all of its
+   objects free and constructed, or returns a null pointer if
+   memory is not available.  C's lock must be held. */
+static struct slab *
+slab_create (struct kmem_cache *c)
+{
+  struct slab *s;
+  size_t i;
+
+  s = palloc_get_page (0);
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->objs = (uint8_t *) s + c->objs_ofs + c->color_next;
+  s->free_cnt = c->objs_per_slab;
+
+  /* Hand out objects in address order. */
+  for (i = 0; i < c->objs_per_slab; i++)
+    {
+      s->free[c->objs_per_slab - 1 - i] = i;
+      if (c->ctor != NULL)
+        c->ctor (s->objs + i * c->size);
+    }
+
+  c->color_next += COLOR_STEP > c->align ? COLOR_STEP : c->align;
+  if (c->color_next > c->color_max)
+    c->color_next = 0;
+
+  c->slab_cnt++;
+  c->grow_cnt++;
+  return s;
+}
+
+/* Returns slab S, which must have no objects in use and must not
+   be in any of C's lists, to the page allocator.  C's lock must
+   be held. */
+static void
+slab_destroy (struct kmem_cache *c, struct slab *s)
+{
+  ASSERT (s->free_cnt == c->objs_per_slab);
+
+  s->magic = 0;
+  palloc_free_page (s);
+  c->slab_cnt--;
+  c->reap_cnt++;
+}
+
+/* Returns the slab that object OBJ is inside. */
+static struct slab *
+obj_to_slab (void *obj)
+{
+  struct slab *s = pg_round_down (obj);
+
+  /* Check that the slab is valid. */
+  ASSERT (s != NULL);
+  ASSERT (s->magic == SLAB_MAGIC);
+
+  return s;
+}
@@ -0,0 +1,28 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <stddef.h>
+
+/* Object caches.
+
+   A kmem_cache hands out objects of a single type, carved at
+   their exact size from page-sized "slabs", instead of rounding
+   each request up to a power of 2 as malloc() does.  If the cache
+   has a constructor, it is run once on each object when its slab
+   is created, and objects must be returned to the cache in their
+   constructed state, so that state survives from one allocation
+   to the next. */
+
+struct kmem_cache;
+
+/* Initializes an object at OBJ. */
+typedef void kmem_ctor_func (void *obj);
+
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+                                      size_t align, kmem_ctor_func *);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+
+void kmem_print_stats (void);
+
+#endif /* threads/slab.h */
@@ -32,14 +32,128 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
-/* Less function of locks by priority. */
-static bool lock_priority_less_func (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED);
+/* Less function of waiters by priority, then arrival. */
+static bool waiter_less_func (const struct heap_elem *a, const struct heap_elem *b, void *aux UNUSED);
 
-/* Less function of threads by priority. */
-static bool thread_priority_less_func (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED);
+static void wait_queue_catch_up (struct wait_queue *);
+static void wake_up (struct thread *);
+static void lock_take_donations (struct lock *);
 
-/* Less function of sema by priority. */
-static bool sema_priority_less_func (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED);
+/* Initializes WQ as an empty wait queue. */
+void
+wait_queue_init (struct wait_queue *wq)
+{
+  heap_init (&wq->waiters, waiter_less_func, NULL);
+  wq->next_seq = 0;
+  wq->decay_epoch = 0;
+}
+
+/* Adds the current thread to WQ through W, which must stay
+   valid until the thread is removed from WQ.  Interrupts must
+   be off. */
+void
+wait_queue_push (struct wait_queue *wq, struct waiter *w)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  w->thread = thread_current ();
+  w->queue = wq;
+  w->seq = wq->next_seq++;
+  w->woken = false;
+  w->thread->waiter = w;
+  heap_insert (&wq->waiters, &w->elem);
+}
+
+/* Removes the highest-priority, longest-waiting thread from WQ,
+   which must not be empty, and returns it.  Interrupts must be
+   off. */
+struct thread *
+wait_queue_pop (struct wait_queue *wq)
+{
+  struct waiter *w;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  wait_queue_catch_up (wq);
+  w = heap_entry (heap_pop (&wq->waiters), struct waiter, elem);
+  w->thread->waiter = NULL;
+  w->queue = NULL;
+  w->woken = true;
+  return w->thread;
+}
+
+/* Returns true if no thread is waiting in WQ. */
+bool
+wait_queue_empty (const struct wait_queue *wq)
+{
+  return heap_empty (&wq->waiters);
+}
+
+/* Returns the highest priority of the threads waiting in WQ,
+   or PRI_MIN if there are none.  Interrupts must be off. */
+int
+wait_queue_max_priority (struct wait_queue *wq)
+{
+  struct heap_elem *top;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  wait_queue_catch_up (wq);
+  top = heap_top (&wq->waiters);
+  if (top == NULL)
+    return PRI_MIN;
+  return heap_entry (top, struct waiter, elem)->thread->priority;
+}
+
+/* Moves W to the place in its queue that matches its thread's
+   current priority.  Called by thread.c whenever the priority
+   of a waiting thread changes.  Interrupts must be off. */
+void
+wait_queue_requeue (struct waiter *w)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  heap_remove (&w->queue->waiters, &w->elem);
+  heap_insert (&w->queue->waiters, &w->elem);
+}
+
+/* Under the MLFQS, applies the recent_cpu decays that the
+   threads waiting in WQ have missed while blocked, and the
+   priority changes that follow, at most once per decay epoch.
+   Interrupts must be off. */
+static void
+wait_queue_catch_up (struct wait_queue *wq)
+{
+  struct heap_elem *stale = NULL;
+  int epoch;
+
+  if (!thread_mlfqs)
+    return;
+  epoch = thread_mlfqs_get_decay_epoch ();
+  if (wq->decay_epoch == epoch)
+    return;
+  wq->decay_epoch = epoch;
+
+  /* A priority change would requeue the waiter in place, so take
+     all of them out first, chained through their heap elements,
+     and put each back once its priority is current. */
+  while (!heap_empty (&wq->waiters))
+    {
+      struct heap_elem *e = heap_pop (&wq->waiters);
+      e->next = stale;
+      stale = e;
+    }
+  while (stale != NULL)
+    {
+      struct waiter *w = heap_entry (stale, struct waiter, elem);
+
+      stale = stale->next;
+      w->thread->waiter = NULL;
+      thread_mlfqs_update_recent_cpu_single (w->thread, NULL);
+      w->thread->waiter = w;
+      heap_insert (&wq->waiters, &w->elem);
+    }
+}
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -56,7 +170,7 @@ sema_init (struct semaphore *sema, unsigned value)
   ASSERT (sema != NULL);
 
   sema->value = value;
-  list_init (&sema->waiters);
+  wait_queue_init (&sema->waiters);
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -77,7 +191,8 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0) 
     {
-      list_insert_ordered (&sema->waiters, &thread_current ()->elem, thread_priority_less_func, NULL);
+      struct waiter waiter;
+      wait_queue_push (&sema->waiters, &waiter);
       thread_block ();
     }
   sema->value--;
@@ -122,22 +237,9 @@ sema_up (struct semaphore *sema)
   ASSERT (sema != NULL);
 
   old_level = intr_disable ();
-
-  struct thread *unblocked = NULL;
-
-  while (!list_empty (&sema->waiters)) 
-  {
-    // list_sort (&sema->waiters, thread_priority_less_func, NULL);
-    unblocked = list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem);
-    thread_unblock (unblocked);    
-  }
   sema->value++;
-  if (unblocked != NULL 
-      && unblocked->priority > thread_current ()->priority)
-  {
-    thread_yield ();
-  }
+  if (!wait_queue_empty (&sema->waiters))
+    wake_up (wait_queue_pop (&sema->waiters));
   intr_set_level (old_level);
 }
 
@@ -222,31 +324,31 @@ lock_acquire (struct lock *lock)
   struct thread* cur_thd = thread_current ();
   struct lock* iter_lock = lock;
   
-  if (lock->holder != NULL){
-    cur_thd->waiting_lock = lock;
-  }
-  else{
-    lock->priority = cur_thd->priority;
-  }
-
-  while ( !thread_mlfqs && iter_lock != NULL
-        && iter_lock->holder != NULL
-        && cur_thd->priority > iter_lock->holder->priority)
+  if (!thread_mlfqs && lock->holder != NULL)
   {
-    iter_lock->priority = cur_thd->priority;
-    thread_priority_donation (iter_lock->holder, cur_thd->priority);
-    iter_lock = iter_lock->holder->waiting_lock;
+    /* Donate our priority down the chain of lock holders.  Each
+       step only moves one donation count on the holder, so no
+       queue has to be re-sorted. */
+    cur_thd->waiting_lock = lock;
+    while (iter_lock != NULL && iter_lock->holder != NULL
+           && cur_thd->priority > iter_lock->priority)
+    {
+      int old_priority = iter_lock->priority;
+      iter_lock->priority = cur_thd->priority;
+      thread_donation_change (iter_lock->holder, old_priority,
+                              iter_lock->priority);
+      iter_lock = iter_lock->holder->waiting_lock;
+    }
   }
   
   sema_down (&lock->semaphore);
+  lock->holder = cur_thd;
   if (!thread_mlfqs)
   {
     ASSERT (intr_get_level () == INTR_OFF);
-    cur_thd = thread_current ();
     cur_thd->waiting_lock = NULL;
-    list_push_back (&cur_thd->lock_list, &lock->elem);
+    lock_take_donations (lock);
   }
-  lock->holder = cur_thd;
 
   intr_set_level (old_level);
 }
@@ -265,9 +367,15 @@ lock_try_acquire (struct lock *lock)
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  enum intr_level old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      lock->holder = thread_current ();
+      if (!thread_mlfqs)
+        lock_take_donations (lock);
+    }
+  intr_set_level (old_level);
   return success;
 }
 
@@ -282,27 +390,29 @@ lock_release (struct lock *lock)
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  enum intr_level old_level = intr_disable ();
+  struct thread *cur = thread_current ();
+
+  /* Give back what was donated through LOCK before waking a
+     waiter, so that sema_up() compares against our own priority. */
   lock->holder = NULL;
+  if (!thread_mlfqs)
+    thread_donation_remove (cur, lock->priority);
   sema_up (&lock->semaphore);
-
-  if (thread_mlfqs)
-    return;
-  struct thread *cur = thread_current ();
-  list_remove (&lock->elem);
-  if (list_empty (&cur->lock_list)){
-    thread_set_priority (cur->prev_priority);
-  }
-  else{
-    int lock_priority = 0;
-    if (!list_empty (&cur->lock_list))
-    {
-      list_sort (&cur->lock_list, lock_priority_less_func, NULL);
-      lock_priority = list_entry (list_front (&cur->lock_list), struct lock, elem)->priority;
-    }
-    int max_priority = (lock_priority > cur->prev_priority)? lock_priority:cur->prev_priority;
-    cur->priority = max_priority;
+  if (!thread_mlfqs)
     thread_yield ();
-  }
+
+  intr_set_level (old_level);
+}
+
+/* Makes the current thread, which just acquired LOCK, the
+   receiver of the priorities donated by the threads still
+   waiting for LOCK. */
+static void
+lock_take_donations (struct lock *lock)
+{
+  lock->priority = wait_queue_max_priority (&lock->semaphore.waiters);
+  thread_donation_add (lock->holder, lock->priority);
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -316,12 +426,55 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
-/* One semaphore in a list. */
-struct semaphore_elem 
-  {
-    struct list_elem elem;              /* List element. */
-    struct semaphore semaphore;         /* This semaphore. */
-  };
+/* Initializes spinlock SL as unheld. */
+void
+spinlock_init (struct spinlock *sl)
+{
+  ASSERT (sl != NULL);
+
+  sl->locked = 0;
+}
+
+/* Disables interrupts and then spins until SL can be taken.
+   The interrupt level is restored by spinlock_release(). */
+void
+spinlock_acquire (struct spinlock *sl)
+{
+  enum intr_level old_level;
+  uint32_t held = 1;
+
+  ASSERT (sl != NULL);
+
+  old_level = intr_disable ();
+  for (;;)
+    {
+      /* `xchg' with a memory operand is implicitly locked. */
+      asm volatile ("xchgl %0, %1" : "+r" (held), "+m" (sl->locked)
+                    : : "memory");
+      if (held == 0)
+        break;
+      while (sl->locked != 0)
+        asm volatile ("pause");
+      held = 1;
+    }
+  sl->old_level = old_level;
+}
+
+/* Releases SL and restores the interrupt level that was in
+   effect when it was acquired. */
+void
+spinlock_release (struct spinlock *sl)
+{
+  enum intr_level old_level;
+
+  ASSERT (sl != NULL);
+  ASSERT (sl->locked != 0);
+
+  old_level = sl->old_level;
+  barrier ();
+  sl->locked = 0;
+  intr_set_level (old_level);
+}
 
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
@@ -331,7 +484,7 @@ cond_init (struct condition *cond)
 {
   ASSERT (cond != NULL);
 
-  list_init (&cond->waiters);
+  wait_queue_init (&cond->waiters);
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -357,17 +510,23 @@ cond_init (struct condition *cond)
 void
 cond_wait (struct condition *cond, struct lock *lock) 
 {
-  struct semaphore_elem waiter;
+  struct waiter waiter;
+  enum intr_level old_level;
 
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
   
-  sema_init (&waiter.semaphore, 0);
-  list_push_back(&cond->waiters, &waiter.elem);
+  old_level = intr_disable ();
+  wait_queue_push (&cond->waiters, &waiter);
   lock_release (lock);
-  sema_down (&waiter.semaphore);
+
+  /* lock_release() may have yielded, in which case we may
+     already have been signaled. */
+  while (!waiter.woken)
+    thread_block ();
+  intr_set_level (old_level);
   lock_acquire (lock);
 }
 
@@ -386,12 +545,10 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-  if (!list_empty (&cond->waiters))
-  {
-    list_sort (&cond->waiters, sema_priority_less_func, NULL);
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
-  }
+  enum intr_level old_level = intr_disable ();
+  if (!wait_queue_empty (&cond->waiters))
+    wake_up (wait_queue_pop (&cond->waiters));
+  intr_set_level (old_level);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -406,35 +563,39 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
 
-  while (!list_empty (&cond->waiters))
+  while (!wait_queue_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
 
-/* Less function of locks by priority. */
+/* Less function of waiters by priority, then arrival.  A
+   waiter that arrived later is "less" than an earlier one of the
+   same priority, so that equal priorities are served FIFO. */
 static bool
-lock_priority_less_func (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED)
+waiter_less_func (const struct heap_elem *a, const struct heap_elem *b, void *aux UNUSED)
 {
-  struct lock* a_lock = list_entry (a, struct lock, elem);
-  struct lock* b_lock = list_entry (b, struct lock, elem);
-  return a_lock->priority > b_lock->priority;
+  struct waiter* a_waiter = heap_entry (a, struct waiter, elem);
+  struct waiter* b_waiter = heap_entry (b, struct waiter, elem);
+  int a_pri = a_waiter->thread->priority;
+  int b_pri = b_waiter->thread->priority;
+
+  if (a_pri != b_pri)
+    return a_pri < b_pri;
+  return (int) (a_waiter->seq - b_waiter->seq) > 0;
 }
 
-/* Less function of threads by priority. */
-static bool
-thread_priority_less_func (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED)
+/* Makes T, just removed from a wait queue, ready to run if it is
+   blocked, and preempts the current thread if T has a higher
+   priority. */
+static void
+wake_up (struct thread *t)
 {
-  struct thread* a_thread = list_entry (a, struct thread, elem);
-  struct thread* b_thread = list_entry (b, struct thread, elem);
-  return a_thread->priority > b_thread->priority;
+  if (t->status == THREAD_BLOCKED)
+    thread_unblock (t);
+  if (t->priority > thread_current ()->priority)
+    {
+      if (intr_context ())
+        intr_yield_on_return ();
+      else
+        thread_yield ();
+    }
 }
-
-/* Less function of sema by priority. */
-static bool
-sema_priority_less_func (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED)
-{
-  struct semaphore_elem* a_sema = list_entry (a, struct semaphore_elem, elem);
-  struct semaphore_elem* b_sema = list_entry (b, struct semaphore_elem, elem);
-  int a_sema_pri = list_entry (list_front (&a_sema->semaphore.waiters), struct thread, elem)->priority;
-  int b_sema_pri = list_entry (list_front (&b_sema->semaphore.waiters), struct thread, elem)->priority;
-  return a_sema_pri > b_sema_pri;
-}
\ No newline at end of file
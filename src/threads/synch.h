@@ -1,14 +1,48 @@
 #ifndef THREADS_SYNCH_H
 #define THREADS_SYNCH_H
 
+#include <heap.h>
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include "threads/interrupt.h"
+
+/* A queue of waiting threads, ordered by priority and, among
+   threads of equal priority, by arrival.  When a waiting
+   thread's priority changes, thread.c calls wait_queue_requeue()
+   so that the order never goes stale.  Under the MLFQS, blocked
+   threads miss the once-a-second recent_cpu decay, so the
+   waiters catch up on it before the queue is next inspected. */
+struct wait_queue
+  {
+    struct heap waiters;        /* Waiters, highest priority on top. */
+    unsigned next_seq;          /* Arrival stamp for the next waiter. */
+    int decay_epoch;            /* MLFQS decay waiters are caught up to. */
+  };
+
+/* A thread in a wait queue.  Lives on the waiting thread's
+   stack and is pointed to by its `waiter' member. */
+struct waiter
+  {
+    struct heap_elem elem;      /* Heap element. */
+    struct thread *thread;      /* Waiting thread. */
+    struct wait_queue *queue;   /* Queue this waiter is in. */
+    unsigned seq;               /* Arrival stamp. */
+    bool woken;                 /* Removed from the queue by a wakeup? */
+  };
+
+void wait_queue_init (struct wait_queue *);
+void wait_queue_push (struct wait_queue *, struct waiter *);
+struct thread *wait_queue_pop (struct wait_queue *);
+bool wait_queue_empty (const struct wait_queue *);
+int wait_queue_max_priority (struct wait_queue *);
+void wait_queue_requeue (struct waiter *);
 
 /* A counting semaphore. */
 struct semaphore 
   {
     unsigned value;             /* Current value. */
-    struct list waiters;        /* List of waiting threads. */
+    struct wait_queue waiters;  /* Waiting threads. */
   };
 
 void sema_init (struct semaphore *, unsigned value);
@@ -22,10 +56,8 @@ struct lock
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
-    struct list_elem elem;      /* List element of the lock. Lock can be 
-                                   treated as a list element. */
-    int priority;               /* Priority of the lock. Should be equal 
-                                   to the highest priority of its holders. */ 
+    int priority;               /* Highest priority donated to the
+                                   holder through this lock. */ 
   };
 
 void lock_init (struct lock *);
@@ -34,10 +66,24 @@ bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
 
+/* Spinlock.  Busy-waits instead of sleeping, and keeps
+   interrupts off while held, so it may be used inside the
+   scheduler and from interrupt handlers.  Hold it only for a
+   few instructions. */
+struct spinlock
+  {
+    volatile uint32_t locked;   /* Nonzero while held. */
+    enum intr_level old_level;  /* Interrupt level before acquire. */
+  };
+
+void spinlock_init (struct spinlock *);
+void spinlock_acquire (struct spinlock *);
+void spinlock_release (struct spinlock *);
+
 /* Condition variable. */
 struct condition 
   {
-    struct list waiters;        /* List of waiting threads. */
+    struct wait_queue waiters;  /* Waiting threads. */
   };
 
 void cond_init (struct condition *);
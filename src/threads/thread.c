@@ -4,6 +4,7 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
@@ -21,13 +22,33 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
-
-/* List of all sleeping threads. Threads are added to this list
-   when `timer_sleep ()` called and removed when they stop sleeping.*/
-static struct list sleeping_list;
+/* Run queue of processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running.
+   There is one FIFO list per priority, and bit P of
+   ready_bitmap is set iff ready_queues[P] is non-empty, so the
+   highest-priority ready thread is found with a single bit scan
+   instead of sorting. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_bitmap;
+static size_t ready_cnt;        /* # of threads in ready_queues. */
+
+/* Hierarchical timing wheel of all sleeping threads.  Threads
+   are added to it when `timer_sleep ()' is called and removed
+   when they stop sleeping.
+
+   Level 0 has one slot per tick for the next WHEEL_SIZE ticks,
+   and each higher level covers WHEEL_SIZE times the span of the
+   level below.  A thread is filed by how far its wakeup_time is
+   from wheel_time, so insertion is O(1).  When level 0 wraps
+   around, the matching slot of level 1 is cascaded down into
+   level 0 (and so on up the levels), so each tick only touches
+   the slot that is due. */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+static struct list sleeping_wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static int64_t wheel_time;      /* Next tick to be processed. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -45,11 +66,26 @@ static struct lock tid_lock;
 /* Load average. */
 static fix_point load_avg;
 
-/* Less function of threads by wait time. */
-static bool thread_wait_less_func (const struct list_elem *a, const struct list_elem *b, void *aux);
-
-/* Less function of threads by priority. */
-static bool thread_priority_less_func (const struct list_elem *a, const struct list_elem *b, void *aux);
+/* Lazy recent_cpu decay.  Once per second the decay coefficient
+   (2*load_avg)/(2*load_avg + 1) is computed, recorded in a ring
+   indexed by decay_epoch, and applied right away only to the
+   running and ready threads.  A blocked thread remembers the last
+   epoch it was decayed to and catches up from the ring when it is
+   next unblocked, or, if it is in a wait queue, when the queue
+   next chooses among its waiters. */
+#define DECAY_HISTORY 64
+static int decay_epoch;                         /* # of decays so far. */
+static fix_point decay_coeffs[DECAY_HISTORY];   /* Recent coefficients. */
+
+static void wheel_insert (struct thread *);
+static void wheel_cascade (int level);
+
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
+static struct thread *ready_pop (void);
+static void thread_change_priority (struct thread *, int priority);
+static void thread_update_priority (struct thread *);
+static int highest_bit (uint64_t);
 
 /* Stack frame for kernel_thread(). */
 struct kernel_thread_frame 
@@ -101,12 +137,20 @@ static tid_t allocate_tid (void);
 void
 thread_init (void) 
 {
+  int pri, level, slot;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (pri = PRI_MIN; pri <= PRI_MAX; pri++)
+    list_init (&ready_queues[pri]);
+  ready_bitmap = 0;
+  ready_cnt = 0;
   list_init (&all_list);
-  list_init (&sleeping_list);
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SIZE; slot++)
+      list_init (&sleeping_wheel[level][slot]);
+  wheel_time = 0;
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
@@ -267,7 +311,9 @@ thread_unblock (struct thread *t)
 
   // old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
+  if (thread_mlfqs)
+    thread_mlfqs_update_recent_cpu_single (t, NULL);
+  ready_push (t);
 
   t->status = THREAD_READY;
 
@@ -340,7 +386,7 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread) 
-    list_push_back (&ready_list, &cur->elem);
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -364,9 +410,9 @@ thread_foreach (thread_action_func *func, void *aux)
 }
 
 /* Sets the current thread's prev_priority to NEW_PRIORITY. 
-   If NEW_PRIORITY is higher than priority of current thread 
-   or it does not have any lock, set current thread's 
-   priority to NEW_PRIORITY, yield the cpu. */
+   The current thread's priority becomes NEW_PRIORITY, unless
+   a higher priority is still donated to it through a lock it
+   holds, and then it yields the cpu. */
 void
 thread_set_priority (int new_priority) 
 {
@@ -376,12 +422,8 @@ thread_set_priority (int new_priority)
   
   struct thread* cur = thread_current ();
   cur->prev_priority = new_priority;
-
-  if (list_empty (&cur->lock_list) || new_priority > cur->priority)
-    {
-      thread_current ()->priority = new_priority;
-      thread_yield ();
-    }
+  thread_update_priority (cur);
+  thread_yield ();
 
   intr_set_level (old_level);
 }
@@ -514,12 +556,19 @@ init_thread (struct thread *t, const char *name, int priority)
   t->wakeup_time = 0;
   t->waiting_lock = NULL;
   t->prev_priority = priority;
-  list_init(&t->lock_list);
   t->nice = 0;
   t->recent_cpu = int_to_fix(0);
+  t->decay_epoch = decay_epoch;
+#ifdef USERPROG
+  list_init (&t->children);
+  t->exit_code = -1;
+#endif
+#ifdef VM
+  list_init (&t->mappings);
+#endif
 
   old_level = intr_disable ();
-  list_insert_ordered (&all_list, &t->allelem, thread_priority_less_func, NULL);
+  list_push_back (&all_list, &t->allelem);
   intr_set_level (old_level);
 }
 
@@ -544,14 +593,86 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  if (ready_bitmap == 0)
     return idle_thread;
   else
-  {
+    return ready_pop ();
+}
+
+/* Appends T to the back of the run queue for its priority. */
+static void
+ready_push (struct thread *t)
+{
+  ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
 
-    list_sort(&ready_list, thread_priority_less_func, NULL);
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
-  }
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_bitmap |= (uint64_t) 1 << t->priority;
+  ready_cnt++;
+}
+
+/* Removes T from the run queue for its priority. */
+static void
+ready_remove (struct thread *t)
+{
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[t->priority]))
+    ready_bitmap &= ~((uint64_t) 1 << t->priority);
+  ready_cnt--;
+}
+
+/* Removes and returns the thread at the front of the highest
+   non-empty run queue.  The run queue must not be empty. */
+static struct thread *
+ready_pop (void)
+{
+  struct thread *t;
+
+  t = list_entry (list_front (&ready_queues[highest_bit (ready_bitmap)]),
+                  struct thread, elem);
+  ready_remove (t);
+  return t;
+}
+
+/* Returns the index of the most significant set bit in BITS,
+   which must not be 0. */
+static int
+highest_bit (uint64_t bits)
+{
+  uint32_t high = bits >> 32;
+  uint32_t low = bits;
+
+  ASSERT (bits != 0);
+
+  /* Split into two 32-bit halves so that this is a plain `bsr'
+     on i386. */
+  if (high != 0)
+    return 63 - __builtin_clz (high);
+  else
+    return 31 - __builtin_clz (low);
+}
+
+/* Sets T's priority to PRIORITY, moving T to the matching run
+   queue if it is ready and to its new place in the wait queue
+   it is in, if any.  Interrupts must be off. */
+static void
+thread_change_priority (struct thread *t, int priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->priority == priority)
+    return;
+
+  if (t->status == THREAD_READY)
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
+  else
+    t->priority = priority;
+
+  if (t->waiter != NULL)
+    wait_queue_requeue (t->waiter);
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -583,6 +704,11 @@ thread_schedule_tail (struct thread *prev)
   /* Start new time slice. */
   thread_ticks = 0;
 
+  /* If we just left the idle thread, the timer may be set to go
+     off far in the future.  Bring back the regular tick. */
+  if (timer_tickless && prev != NULL && prev == idle_thread)
+    timer_leave_idle ();
+
 #ifdef USERPROG
   /* Activate the new address space. */
   process_activate ();
@@ -641,73 +767,170 @@ allocate_tid (void)
    Used by switch.S, which can't figure it out on its own. */
 uint32_t thread_stack_ofs = offsetof (struct thread, stack);
 
+/* Put the thread into the timing wheel and block it until
+    its wakeup_time.  Must be called with interrupts off. */
 void
 thread_to_wait (struct thread *thd)
 {
-  list_insert_ordered (&sleeping_list, &thd->elem, thread_wait_less_func, NULL);
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  wheel_insert (thd);
   thread_block ();
 }
 
-/* Less function of threads by wait time. */
-static bool
-thread_wait_less_func (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED)
+/* File THD into the timing wheel slot for its wakeup_time.
+    A thread that is already due goes into the slot processed
+    next; one too far away for the top level goes into the last
+    top-level slot and is re-filed when that slot cascades. */
+static void
+wheel_insert (struct thread *thd)
+{
+  int64_t expires = thd->wakeup_time;
+  int64_t delta = expires - wheel_time;
+  int level;
+
+  if (delta < 0)
+    {
+      expires = wheel_time;
+      delta = 0;
+    }
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+      break;
+  if (delta >= (int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+    expires = wheel_time + ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+  list_push_back (&sleeping_wheel[level][(expires >> (WHEEL_BITS * level))
+                                         & WHEEL_MASK],
+                  &thd->elem);
+}
+
+/* Re-file every thread in the current slot of LEVEL into the
+    levels below it.  If that slot is slot 0, the level above
+    has wrapped too and is cascaded first. */
+static void
+wheel_cascade (int level)
 {
-  struct thread* a_thread = list_entry (a, struct thread, elem);
-  struct thread* b_thread = list_entry (b, struct thread, elem);
-  return a_thread->wakeup_time <= b_thread->wakeup_time;
+  int slot = (wheel_time >> (WHEEL_BITS * level)) & WHEEL_MASK;
+  struct list *bucket = &sleeping_wheel[level][slot];
+
+  if (slot == 0 && level + 1 < WHEEL_LEVELS)
+    wheel_cascade (level + 1);
+
+  while (!list_empty (bucket))
+    wheel_insert (list_entry (list_pop_front (bucket), struct thread, elem));
 }
 
-/* Traverse the sleeping_list and check the wakeup_time.
-    if a thread's wakeup_time is bigger than current_tick,
-    quit the function*/
+/* Return the first tick, no later than LIMIT, at which the
+    timing wheel has a thread to wake up or a level to cascade,
+    or LIMIT if there is none.  Must be called with interrupts
+    off. */
+int64_t
+thread_next_wakeup (int64_t limit)
+{
+  int64_t t;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (t = wheel_time; t < limit; t++)
+    if ((t & WHEEL_MASK) == 0
+        || !list_empty (&sleeping_wheel[0][t & WHEEL_MASK]))
+      return t;
+  return limit;
+}
+
+/* Return true if this CPU is running its idle thread and has
+    no other thread ready to run. */
+bool
+thread_cpu_idle (void)
+{
+  return running_thread () == idle_thread && ready_cnt == 0;
+}
+
+/* Advance the timing wheel up to CURRENT_TICK and wake up every
+    thread in the level-0 slots that became due. */
 void
 thread_check_awake (int64_t current_tick)
 {
-  if (list_empty (&sleeping_list))
-    return;
+  enum intr_level old_level = intr_disable ();
 
-  struct list_elem *iter = sleeping_list.head.next;
-  while (iter != &sleeping_list.tail)
-  {
-    struct list_elem *next_iter = iter->next;
-    struct thread* iter_thd = list_entry (iter, struct thread, elem);
-    if (iter_thd->wakeup_time > current_tick){
-      break;
+  while (wheel_time <= current_tick)
+    {
+      int slot = wheel_time & WHEEL_MASK;
+      struct list *bucket = &sleeping_wheel[0][slot];
+
+      if (slot == 0)
+        wheel_cascade (1);
+
+      while (!list_empty (bucket))
+        {
+          struct thread *t = list_entry (list_pop_front (bucket),
+                                         struct thread, elem);
+          ASSERT (t->wakeup_time <= wheel_time);
+          thread_unblock (t);
+        }
+      wheel_time++;
     }
-    enum intr_level old_level = intr_disable ();
-    list_remove(iter);
-    thread_unblock (iter_thd);
-    intr_set_level (old_level);
-    iter = next_iter;
-  }  
+
+  intr_set_level (old_level);
 }
 
-/* Less function of threads by priority. */
-static bool
-thread_priority_less_func (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED)
+/* Record that THD now holds a lock through which PRIORITY is
+    donated, and raise THD's priority if needed.
+
+    The donation functions are only called with mlfqs down and
+    interrupts off. */
+void
+thread_donation_add (struct thread *thd, int priority)
 {
-  struct thread* a_thread = list_entry (a, struct thread, elem);
-  struct thread* b_thread = list_entry (b, struct thread, elem);
-  return a_thread->priority > b_thread->priority;
+  ASSERT (is_thread (thd));
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+  thd->donations[priority]++;
+  thd->donation_bitmap |= (uint64_t) 1 << priority;
+  thread_update_priority (thd);
 }
 
-/* Set the thread's priority to donated priority and resort the readly_list
-    
-    This function only be called with mlfqs down*/
+/* Record that THD released a lock through which PRIORITY was
+    donated, and lower THD's priority if needed. */
 void
-thread_priority_donation(struct thread *thd, int priority){
-  if (thread_mlfqs)
-    return;
-  enum intr_level old_level = intr_disable ();
-
+thread_donation_remove (struct thread *thd, int priority)
+{
   ASSERT (is_thread (thd));
-  thd->priority = priority;
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (thd->donations[priority] > 0);
 
-  if (thd->status == THREAD_READY){
-    list_sort (&ready_list, thread_priority_less_func, NULL);
-  }
+  if (--thd->donations[priority] == 0)
+    thd->donation_bitmap &= ~((uint64_t) 1 << priority);
+  thread_update_priority (thd);
+}
 
-  intr_set_level (old_level);
+/* Record that the priority donated through one of THD's locks
+    changed from OLD_PRIORITY to NEW_PRIORITY. */
+void
+thread_donation_change (struct thread *thd, int old_priority,
+                        int new_priority)
+{
+  thread_donation_add (thd, new_priority);
+  thread_donation_remove (thd, old_priority);
+}
+
+/* Set THD's priority to the higher of its own priority and
+    the highest priority donated to it, moving it to the matching
+    run queue if it is ready. */
+static void
+thread_update_priority (struct thread *thd)
+{
+  int priority = thd->prev_priority;
+
+  if (thd->donation_bitmap != 0)
+    {
+      int donated = highest_bit (thd->donation_bitmap);
+      if (donated > priority)
+        priority = donated;
+    }
+  thread_change_priority (thd, priority);
 }
 
 /* Update the current thread's recent_cpu with plus one
@@ -727,7 +950,7 @@ void
 thread_mlfqs_update_load_avg ()
 {
   enum intr_level old_level = intr_disable ();
-  int ready_threads = (int)list_size (&ready_list);
+  int ready_threads = (int) ready_cnt;
   if (thread_current () != idle_thread)
     ready_threads ++;
   load_avg = add (div_int (mul_int (load_avg, 59), 60),
@@ -735,25 +958,77 @@ thread_mlfqs_update_load_avg ()
   intr_set_level (old_level);
 }
 
-/* Update the recent_cpu for each thread*/
+/* Start a new decay epoch and update the recent_cpu of the
+    running thread and the ready threads.  Blocked threads are
+    left to catch up when they are unblocked or when their wait
+    queue is next inspected. */
 void 
 thread_mlfqs_update_recent_cpu ()
 {
   enum intr_level old_level = intr_disable ();
-  thread_foreach(thread_mlfqs_update_recent_cpu_single, NULL);
+  int pri;
+
+  decay_epoch++;
+  decay_coeffs[decay_epoch % DECAY_HISTORY]
+    = div (mul_int (load_avg, 2), add_int (mul_int (load_avg, 2), 1));
+
+  thread_mlfqs_update_recent_cpu_single (thread_current (), NULL);
+  for (pri = PRI_MIN; pri <= PRI_MAX; pri++)
+    {
+      struct list_elem *e = list_begin (&ready_queues[pri]);
+      while (e != list_end (&ready_queues[pri]))
+        {
+          /* Updating the priority may move the thread to another
+             queue, so step past it first. */
+          struct thread *t = list_entry (e, struct thread, elem);
+          e = list_next (e);
+          thread_mlfqs_update_recent_cpu_single (t, NULL);
+        }
+    }
   intr_set_level (old_level);
 }
 
-/* Update the recent_cpu and the priority for a single thread*/
+/* Apply every decay the thread has missed since its last
+    decay_epoch, then update its priority.  Epochs older than the
+    coefficient ring reuse the oldest coefficient still in it. */
 void 
 thread_mlfqs_update_recent_cpu_single (struct thread *thd, void *aux UNUSED)
 {
-  if (thd != idle_thread)
+  fix_point coeff;
+  int missed;
+
+  if (thd == idle_thread || thd->decay_epoch == decay_epoch)
+    return;
+
+  missed = decay_epoch - thd->decay_epoch;
+  if (missed > DECAY_HISTORY)
     {
-      thd->recent_cpu = add_int (mul (div (mul_int (load_avg, 2), 
-                        add_int(mul_int(load_avg, 2), 1)), thd->recent_cpu), thd->nice);
-      thread_mlfqs_update_priority(thd);
+      coeff = decay_coeffs[(decay_epoch + 1) % DECAY_HISTORY];
+      for (; missed > DECAY_HISTORY; missed--)
+        {
+          fix_point recent_cpu = add_int (mul (coeff, thd->recent_cpu), 
+                                          thd->nice);
+          if (recent_cpu == thd->recent_cpu)
+            break;
+          thd->recent_cpu = recent_cpu;
+        }
+      thd->decay_epoch = decay_epoch - DECAY_HISTORY;
     }
+
+  while (thd->decay_epoch != decay_epoch)
+    {
+      thd->decay_epoch++;
+      coeff = decay_coeffs[thd->decay_epoch % DECAY_HISTORY];
+      thd->recent_cpu = add_int (mul (coeff, thd->recent_cpu), thd->nice);
+    }
+  thread_mlfqs_update_priority (thd);
+}
+
+/* Returns the number of recent_cpu decays applied so far. */
+int
+thread_mlfqs_get_decay_epoch (void)
+{
+  return decay_epoch;
 }
 
 /* UPdate the priority for a single thread*/
@@ -764,12 +1039,13 @@ thread_mlfqs_update_priority (struct thread *thd)
     return;
   enum intr_level old_level = intr_disable ();
   
-  thd->priority = fix_to_int_round (sub_int (sub (int_to_fix (PRI_MAX), 
+  int priority = fix_to_int_round (sub_int (sub (int_to_fix (PRI_MAX), 
                   div_int (thd->recent_cpu, 4)), (2*(thd->nice))));
-  if (thd->priority > PRI_MAX)
-    thd->priority = PRI_MAX;
-  if (thd->priority < PRI_MIN)
-    thd->priority = PRI_MIN;
+  if (priority > PRI_MAX)
+    priority = PRI_MAX;
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  thread_change_priority (thd, priority);
   intr_set_level (old_level);
   
 }
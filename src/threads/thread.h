@@ -5,6 +5,11 @@
 #include <list.h>
 #include <stdint.h>
 
+struct file;
+struct hash;
+struct wait_status;
+struct waiter;
+
 /* States in a thread's life cycle. */
 enum thread_status
   {
@@ -19,6 +24,9 @@ enum thread_status
 typedef int tid_t;
 #define TID_ERROR ((tid_t) -1)          /* Error value for tid_t. */
 
+/* Number of files a process may have open. */
+#define FD_CNT 16
+
 /* Thread priorities. */
 #define PRI_MIN 0                       /* Lowest priority. */
 #define PRI_DEFAULT 31                  /* Default priority. */
@@ -91,12 +99,16 @@ struct thread
     int wakeup_time;                    /* Time to wake up from sleeping. */
     struct list_elem allelem;           /* List element for all threads list. */
     
-    int prev_priority;                  /* Previous priority. */
-    struct list lock_list;              /* List of locks held by the thread. */
+    int prev_priority;                  /* Priority before donation. */
+    uint64_t donation_bitmap;           /* Bit P set iff donations[P] != 0. */
+    uint16_t donations[PRI_MAX + 1];    /* # of held locks donating each
+                                           priority. */
     struct lock* waiting_lock;          /* The lock that blocks the thread. */
+    struct waiter *waiter;              /* Our entry in a wait queue, if any. */
 
     int nice;                           /* Nice. */
     int recent_cpu;                     /* Recent CPU. */
+    int decay_epoch;                    /* Last recent_cpu decay applied. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
@@ -104,6 +116,22 @@ struct thread
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    struct wait_status *wait_status;    /* Shared with our parent. */
+    struct list children;               /* Our children's wait_status. */
+    int exit_code;                      /* Exit code, -1 if killed. */
+#ifdef VM
+    struct file *exec_file;             /* Executable, open for paging. */
+
+    /* Owned by vm/page.c. */
+    struct hash *pages;                 /* Supplemental page table. */
+
+    /* Owned by vm/mmap.c. */
+    struct list mappings;               /* Memory-mapped files. */
+    int next_mapid;                     /* Next mapping id. */
+#endif
+
+    /* Owned by userprog/syscall.c. */
+    struct file *files[FD_CNT];         /* Open files, by fd - 2. */
 #endif
 
     /* Owned by thread.c. */
@@ -149,12 +177,18 @@ int thread_get_load_avg (void);
 /* Our newly defined functions */
 void thread_to_wait (struct thread *thd);
 void thread_check_awake (int64_t current_tick);
-void thread_priority_donation (struct thread *thd, int priority);
+int64_t thread_next_wakeup (int64_t limit);
+bool thread_cpu_idle (void);
+void thread_donation_add (struct thread *thd, int priority);
+void thread_donation_remove (struct thread *thd, int priority);
+void thread_donation_change (struct thread *thd, int old_priority,
+                             int new_priority);
 
 void thread_mlfqs_recent_cpu_add_one (void);
 void thread_mlfqs_update_load_avg (void);
 void thread_mlfqs_update_recent_cpu (void);
 void thread_mlfqs_update_priority (struct thread *thd);
 void thread_mlfqs_update_recent_cpu_single (struct thread *thd, void *aux UNUSED);
+int thread_mlfqs_get_decay_epoch (void);
 
 #endif /* threads/thread.h */
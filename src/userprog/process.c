@@ -7,6 +7,7 @@
 #include <string.h>
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
@@ -14,43 +15,102 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
+
+/* A child's exit code, shared with its parent so that the
+   parent can wait for the child even after the child has died,
+   and freed by whichever of the two is done with it last. */
+struct wait_status
+  {
+    struct list_elem elem;      /* Element in parent's `children'. */
+    struct lock lock;           /* Protects ref_cnt. */
+    int ref_cnt;                /* Number of parent and child alive. */
+    tid_t tid;                  /* Child's thread id. */
+    int exit_code;              /* Child's exit code, once dead. */
+    struct semaphore dead;      /* Upped when the child dies. */
+  };
+
+/* Passed from process_execute() to the child's start_process(). */
+struct exec_info
+  {
+    char *cmd_line;             /* Command line, in its own page. */
+    struct semaphore loaded;    /* Upped when child has loaded. */
+    struct wait_status *wait_status; /* Child's, or null on failure. */
+  };
 
 static thread_func start_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static struct wait_status *wait_status_create (void);
+static void wait_status_release (struct wait_status *);
+#ifdef VM
+static thread_func start_fork NO_RETURN;
+static bool copy_files (struct thread *parent);
+
+/* Passed from process_fork() to the child's start_fork(). */
+struct fork_info
+  {
+    struct thread *parent;      /* Forking process. */
+    struct intr_frame if_;      /* Parent's user registers. */
+    struct semaphore done;      /* Upped when child is set up. */
+    struct wait_status *wait_status; /* Child's, or null on failure. */
+  };
+#endif
 
 /* Starts a new thread running a user program loaded from
-   FILENAME.  The new thread may be scheduled (and may even exit)
+   CMD_LINE, whose first word is the program's name and whose
+   other words are its arguments, as a child of the current
+   process.  The new thread may be scheduled (and may even exit)
    before process_execute() returns.  Returns the new process's
-   thread id, or TID_ERROR if the thread cannot be created. */
+   thread id, or TID_ERROR if the thread cannot be created or the
+   program cannot be loaded. */
 tid_t
-process_execute (const char *file_name) 
+process_execute (const char *cmd_line) 
 {
-  char *fn_copy;
+  struct exec_info info;
+  char name[16];
+  char *save_ptr;
   tid_t tid;
 
-  /* Make a copy of FILE_NAME.
+  /* Make a copy of CMD_LINE.
      Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page (0);
-  if (fn_copy == NULL)
+  info.cmd_line = palloc_get_page (0);
+  if (info.cmd_line == NULL)
     return TID_ERROR;
-  strlcpy (fn_copy, file_name, PGSIZE);
-
-  /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (file_name, PRI_DEFAULT, start_process, fn_copy);
+  strlcpy (info.cmd_line, cmd_line, PGSIZE);
+  sema_init (&info.loaded, 0);
+
+  /* Create a new thread to execute CMD_LINE, named after the
+     program. */
+  strlcpy (name, cmd_line, sizeof name);
+  strtok_r (name, " ", &save_ptr);
+  tid = thread_create (name, PRI_DEFAULT, start_process, &info);
   if (tid == TID_ERROR)
-    palloc_free_page (fn_copy); 
+    {
+      palloc_free_page (info.cmd_line);
+      return TID_ERROR;
+    }
+
+  sema_down (&info.loaded);
+  if (info.wait_status == NULL)
+    return TID_ERROR;
+  list_push_back (&thread_current ()->children, &info.wait_status->elem);
   return tid;
 }
 
 /* A thread function that loads a user process and starts it
    running. */
 static void
-start_process (void *file_name_)
+start_process (void *info_)
 {
-  char *file_name = file_name_;
+  struct exec_info *info = info_;
   struct intr_frame if_;
   bool success;
 
@@ -59,10 +119,16 @@ start_process (void *file_name_)
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
-  success = load (file_name, &if_.eip, &if_.esp);
+  success = load (info->cmd_line, &if_.eip, &if_.esp);
+
+  /* INFO is on the parent's stack, so it must not be touched
+     after it is upped. */
+  palloc_free_page (info->cmd_line);
+  info->wait_status = success ? wait_status_create () : NULL;
+  success = info->wait_status != NULL;
+  sema_up (&info->loaded);
 
   /* If load failed, quit. */
-  palloc_free_page (file_name);
   if (!success) 
     thread_exit ();
 
@@ -76,18 +142,128 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+#ifdef VM
+/* Starts a new thread running a copy of the current process,
+   which is running with user registers F, as if both had just
+   returned from the system call: the child sees a return value
+   of 0.  The child shares all of the parent's frames, with
+   writable pages copy-on-write, so that only the pages that one
+   of them later writes are ever copied.  The child also gets its
+   own copy of each of the parent's open files.  Returns the new
+   process's thread id, or TID_ERROR if the thread cannot be
+   created or its address space or files cannot be set up. */
+tid_t
+process_fork (const struct intr_frame *f)
+{
+  struct fork_info info;
+  tid_t tid;
+
+  info.parent = thread_current ();
+  info.if_ = *f;
+  sema_init (&info.done, 0);
+  tid = thread_create (thread_name (), PRI_DEFAULT, start_fork, &info);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+
+  /* The child needs our page table to stay put until it is done
+     copying it. */
+  sema_down (&info.done);
+  if (info.wait_status == NULL)
+    return TID_ERROR;
+  list_push_back (&info.parent->children, &info.wait_status->elem);
+  return tid;
+}
+
+/* A thread function that copies the address space and open
+   files of the process that forked it and starts it running. */
+static void
+start_fork (void *info_)
+{
+  struct fork_info *info = info_;
+  struct thread *t = thread_current ();
+  struct intr_frame if_ = info->if_;
+  bool success = false;
+
+  t->pagedir = pagedir_create ();
+  if (t->pagedir != NULL)
+    {
+      process_activate ();
+      if (page_table_create ())
+        {
+          t->exec_file = file_reopen (info->parent->exec_file);
+          if (t->exec_file != NULL)
+            {
+              file_deny_write (t->exec_file);
+              success = (page_table_copy (info->parent)
+                         && copy_files (info->parent));
+            }
+        }
+    }
+
+  /* INFO is on the parent's stack, so it must not be touched
+     after this. */
+  info->wait_status = success ? wait_status_create () : NULL;
+  success = info->wait_status != NULL;
+  sema_up (&info->done);
+  if (!success)
+    thread_exit ();
+
+  /* Return from the system call as the child. */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Gives the current process its own copy of each of PARENT's
+   open files, under the same file descriptor and at the same
+   position.  Returns true if successful, false on failure, in
+   which case the files already copied are closed when the
+   process exits. */
+static bool
+copy_files (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  int i;
+
+  for (i = 0; i < FD_CNT; i++)
+    if (parent->files[i] != NULL)
+      {
+        t->files[i] = file_reopen (parent->files[i]);
+        if (t->files[i] == NULL)
+          return false;
+        file_seek (t->files[i], file_tell (parent->files[i]));
+      }
+  return true;
+}
+#endif
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
    child of the calling process, or if process_wait() has already
    been successfully called for the given TID, returns -1
-   immediately, without waiting.
-
-   This function will be implemented in problem 2-2.  For now, it
-   does nothing. */
+   immediately, without waiting. */
 int
-process_wait (tid_t child_tid UNUSED) 
+process_wait (tid_t child_tid) 
 {
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->children); e != list_end (&cur->children);
+       e = list_next (e))
+    {
+      struct wait_status *ws = list_entry (e, struct wait_status, elem);
+      if (ws->tid == child_tid)
+        {
+          int exit_code;
+
+          list_remove (e);
+          sema_down (&ws->dead);
+          exit_code = ws->exit_code;
+          wait_status_release (ws);
+          return exit_code;
+        }
+    }
   return -1;
 }
 
@@ -98,8 +274,33 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
+  if (cur->pagedir != NULL)
+    printf ("%s: exit(%d)\n", cur->name, cur->exit_code);
+
+  /* Tell our parent that we are dead, and forget our children,
+     which may outlive us. */
+  if (cur->wait_status != NULL)
+    {
+      cur->wait_status->exit_code = cur->exit_code;
+      sema_up (&cur->wait_status->dead);
+      wait_status_release (cur->wait_status);
+      cur->wait_status = NULL;
+    }
+  while (!list_empty (&cur->children))
+    wait_status_release (list_entry (list_pop_front (&cur->children),
+                                     struct wait_status, elem));
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
+#ifdef VM
+  /* Write back and remove memory-mapped files, then release the
+     process's frames and swap slots.  This must come first,
+     since pages may be evicted until it is done, and eviction
+     needs the page directory. */
+  mmap_unmap_all ();
+  page_table_destroy ();
+#endif
+
   pd = cur->pagedir;
   if (pd != NULL) 
     {
@@ -114,6 +315,47 @@ process_exit (void)
       pagedir_activate (NULL);
       pagedir_destroy (pd);
     }
+
+#ifdef VM
+  /* Pages can no longer be faulted in, so the executable can be
+     closed. */
+  file_close (cur->exec_file);
+  cur->exec_file = NULL;
+#endif
+  syscall_exit ();
+}
+
+/* Creates and returns the current process's wait status, which
+   its parent must add to its `children', or returns a null
+   pointer on memory allocation failure. */
+static struct wait_status *
+wait_status_create (void)
+{
+  struct thread *t = thread_current ();
+  struct wait_status *ws = malloc (sizeof *ws);
+
+  if (ws == NULL)
+    return NULL;
+  lock_init (&ws->lock);
+  ws->ref_cnt = 2;
+  ws->tid = t->tid;
+  ws->exit_code = -1;
+  sema_init (&ws->dead, 0);
+  t->wait_status = ws;
+  return ws;
+}
+
+/* Drops a reference to WS, freeing it if it was the last. */
+static void
+wait_status_release (struct wait_status *ws)
+{
+  int ref_cnt;
+
+  lock_acquire (&ws->lock);
+  ref_cnt = --ws->ref_cnt;
+  lock_release (&ws->lock);
+  if (ref_cnt == 0)
+    free (ws);
 }
 
 /* Sets up the CPU for running user code in the current
@@ -195,22 +437,27 @@ struct Elf32_Phdr
 #define PF_W 2          /* Writable. */
 #define PF_R 4          /* Readable. */
 
-static bool setup_stack (void **esp);
+static bool setup_stack (const char *cmd_line, void **esp);
+static bool push_args (const char *cmd_line, void **esp);
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
                           uint32_t read_bytes, uint32_t zero_bytes,
                           bool writable);
 
-/* Loads an ELF executable from FILE_NAME into the current thread.
+/* Loads an ELF executable named by the first word of CMD_LINE
+   into the current thread, with the words of CMD_LINE as its
+   arguments.
    Stores the executable's entry point into *EIP
    and its initial stack pointer into *ESP.
    Returns true if successful, false otherwise. */
 bool
-load (const char *file_name, void (**eip) (void), void **esp) 
+load (const char *cmd_line, void (**eip) (void), void **esp) 
 {
   struct thread *t = thread_current ();
   struct Elf32_Ehdr ehdr;
   struct file *file = NULL;
+  char file_name[NAME_MAX + 1];
+  size_t name_len;
   off_t file_ofs;
   bool success = false;
   int i;
@@ -220,9 +467,18 @@ load (const char *file_name, void (**eip) (void), void **esp)
   if (t->pagedir == NULL) 
     goto done;
   process_activate ();
+#ifdef VM
+  if (!page_table_create ())
+    goto done;
+#endif
 
   /* Open executable file. */
-  file = filesys_open (file_name);
+  cmd_line += strspn (cmd_line, " ");
+  name_len = strcspn (cmd_line, " ");
+  strlcpy (file_name, cmd_line,
+           name_len < sizeof file_name ? name_len + 1 : sizeof file_name);
+  if (name_len <= NAME_MAX)
+    file = filesys_open (file_name);
   if (file == NULL) 
     {
       printf ("load: %s: open failed\n", file_name);
@@ -302,7 +558,7 @@ load (const char *file_name, void (**eip) (void), void **esp)
     }
 
   /* Set up stack. */
-  if (!setup_stack (esp))
+  if (!setup_stack (cmd_line, esp))
     goto done;
 
   /* Start address. */
@@ -312,13 +568,25 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
  done:
   /* We arrive here whether the load is successful or not. */
+#ifdef VM
+  /* Keep the executable open so that its pages can be read in
+     when they are first touched.  process_exit() closes it.
+     Deny writes to it meanwhile, because its read-only pages
+     may be shared with other processes running it. */
+  t->exec_file = file;
+  if (file != NULL)
+    file_deny_write (file);
+#else
   file_close (file);
+#endif
   return success;
 }
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -377,6 +645,10 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With virtual memory, the pages are only recorded in the
+   supplemental page table here, and are read or zeroed when the
+   process first touches them.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -387,6 +659,22 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifdef VM
+  while (read_bytes > 0 || zero_bytes > 0) 
+    {
+      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
+      size_t page_zero_bytes = PGSIZE - page_read_bytes;
+
+      if (!page_add_file (upage, file, ofs, page_read_bytes, writable))
+        return false;
+
+      read_bytes -= page_read_bytes;
+      zero_bytes -= page_zero_bytes;
+      ofs += page_read_bytes;
+      upage += PGSIZE;
+    }
+  return true;
+#else
   file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
@@ -422,13 +710,23 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       upage += PGSIZE;
     }
   return true;
+#endif
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
-   user virtual memory. */
+   user virtual memory, and push the words of CMD_LINE onto it.
+   With virtual memory, the page is only recorded here, like the
+   executable's pages, and comes in when the arguments are
+   pushed. */
 static bool
-setup_stack (void **esp) 
+setup_stack (const char *cmd_line, void **esp) 
 {
+#ifdef VM
+  if (!page_add_zero (((uint8_t *) PHYS_BASE) - PGSIZE, true))
+    return false;
+  *esp = PHYS_BASE;
+  return push_args (cmd_line, esp);
+#else
   uint8_t *kpage;
   bool success = false;
 
@@ -437,13 +735,60 @@ setup_stack (void **esp)
     {
       success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
       if (success)
-        *esp = PHYS_BASE;
+        {
+          *esp = PHYS_BASE;
+          success = push_args (cmd_line, esp);
+        }
       else
         palloc_free_page (kpage);
     }
   return success;
+#endif
+}
+
+/* Pushes the words of CMD_LINE onto the stack at *ESP, which
+   must be the top of the current process's stack page, as the
+   ARGC and ARGV arguments to the program's _start(), below a
+   null return address, and updates *ESP.  Returns false if they
+   do not fit in the page. */
+static bool
+push_args (const char *cmd_line, void **esp)
+{
+  size_t len = strlen (cmd_line) + 1;
+  char *args, *token, *save_ptr;
+  char **argv;
+  uint32_t *sp;
+  int argc;
+  size_t i;
+
+  /* Count the words, to know how much room ARGV needs. */
+  argc = 0;
+  for (i = 0; cmd_line[i] != '\0'; i++)
+    if (cmd_line[i] != ' ' && (i == 0 || cmd_line[i - 1] == ' '))
+      argc++;
+  if (len + (argc + 1) * sizeof *argv + 4 * sizeof *sp > PGSIZE)
+    return false;
+
+  /* Copy the words to the top of the stack, then point ARGV at
+     them, below, on a word boundary. */
+  args = (char *) *esp - len;
+  strlcpy (args, cmd_line, len);
+  argv = (char **) ((uintptr_t) args & ~(sizeof *sp - 1)) - (argc + 1);
+  argc = 0;
+  for (token = strtok_r (args, " ", &save_ptr); token != NULL;
+       token = strtok_r (NULL, " ", &save_ptr))
+    argv[argc++] = token;
+  argv[argc] = NULL;
+
+  sp = (uint32_t *) argv;
+  *--sp = (uint32_t) argv;
+  *--sp = argc;
+  *--sp = 0;
+  *esp = sp;
+  return true;
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -463,3 +808,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
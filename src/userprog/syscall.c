@@ -1,10 +1,36 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include "filesys/file.h"
+#include "filesys/filesys.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
+
+/* File descriptors 0 and 1 are the console, so the first file
+   that a process opens gets this descriptor. */
+#define FD_BASE 2
 
 static void syscall_handler (struct intr_frame *);
+static uint32_t get_arg (const struct intr_frame *, int idx);
+static bool check_user (const void *, size_t);
+static char *copy_in_string (const char *);
+static struct file *lookup_fd (int fd);
+
+static int sys_open (const char *ufile);
+static int sys_write (int fd, const void *ubuf, unsigned size);
+static void sys_close (int fd);
+#ifdef VM
+static int sys_mmap (int fd, void *addr);
+#endif
 
 void
 syscall_init (void) 
@@ -12,9 +38,224 @@ syscall_init (void)
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
+/* Closes all of the current process's open files. */
+void
+syscall_exit (void)
+{
+  struct thread *t = thread_current ();
+  int i;
+
+  for (i = 0; i < FD_CNT; i++)
+    {
+      file_close (t->files[i]);
+      t->files[i] = NULL;
+    }
+}
+
 static void
-syscall_handler (struct intr_frame *f UNUSED) 
+syscall_handler (struct intr_frame *f) 
 {
+  switch (get_arg (f, 0))
+    {
+    case SYS_EXIT:
+      thread_current ()->exit_code = get_arg (f, 1);
+      thread_exit ();
+
+    case SYS_WAIT:
+      f->eax = process_wait (get_arg (f, 1));
+      return;
+
+    case SYS_OPEN:
+      f->eax = sys_open ((const char *) get_arg (f, 1));
+      return;
+
+    case SYS_WRITE:
+      f->eax = sys_write (get_arg (f, 1), (const void *) get_arg (f, 2),
+                          get_arg (f, 3));
+      return;
+
+    case SYS_CLOSE:
+      sys_close (get_arg (f, 1));
+      return;
+
+#ifdef VM
+    case SYS_MMAP:
+      f->eax = sys_mmap (get_arg (f, 1), (void *) get_arg (f, 2));
+      return;
+
+    case SYS_MUNMAP:
+      mmap_unmap (get_arg (f, 1));
+      return;
+
+    case SYS_FORK:
+      f->eax = process_fork (f);
+      return;
+#endif
+    }
+
   printf ("system call!\n");
   thread_exit ();
 }
+
+/* Returns word IDX of the system call frame on the user stack of
+   F: the system call number for IDX 0, and its arguments after
+   that.  Terminates the process if the word cannot be read. */
+static uint32_t
+get_arg (const struct intr_frame *f, int idx)
+{
+  const uint32_t *arg = (const uint32_t *) f->esp + idx;
+
+  if (!check_user (arg, sizeof *arg))
+    thread_exit ();
+  return *arg;
+}
+
+/* Returns true if the SIZE bytes at user address UADDR may be
+   read by the current process, bringing them into memory if
+   necessary. */
+static bool
+check_user (const void *uaddr, size_t size)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  const uint8_t *first = uaddr;
+  const uint8_t *last = first + size - 1;
+  const uint8_t *p;
+
+  if (last < first || !is_user_vaddr (last))
+    return false;
+  for (p = pg_round_down (first); p <= last; p += PGSIZE)
+    if (pagedir_get_page (pd, p) == NULL)
+      {
+#ifdef VM
+        if (!page_in ((void *) p))
+#endif
+          return false;
+      }
+  return true;
+}
+
+/* Copies the null-terminated string at user address US into a
+   newly allocated page and returns it.  The caller must free it
+   with palloc_free_page().  Returns a null pointer if the string
+   cannot be read, is longer than a page, or on memory allocation
+   failure. */
+static char *
+copy_in_string (const char *us)
+{
+  char *ks = palloc_get_page (0);
+  size_t len;
+
+  if (ks == NULL)
+    return NULL;
+  for (len = 0; len < PGSIZE && check_user (us + len, 1); len++)
+    {
+      ks[len] = us[len];
+      if (ks[len] == '\0')
+        return ks;
+    }
+  palloc_free_page (ks);
+  return NULL;
+}
+
+/* Returns the current process's open file with descriptor FD,
+   or a null pointer if there is none. */
+static struct file *
+lookup_fd (int fd)
+{
+  if (fd < FD_BASE || fd >= FD_BASE + FD_CNT)
+    return NULL;
+  return thread_current ()->files[fd - FD_BASE];
+}
+
+/* Opens the file named UFILE and returns a new file descriptor
+   for it, or -1 if the file cannot be opened or the process has
+   too many files open. */
+static int
+sys_open (const char *ufile)
+{
+  struct thread *t = thread_current ();
+  char *kfile;
+  int i;
+
+  for (i = 0; i < FD_CNT; i++)
+    if (t->files[i] == NULL)
+      break;
+  if (i == FD_CNT)
+    return -1;
+
+  kfile = copy_in_string (ufile);
+  if (kfile == NULL)
+    thread_exit ();
+  t->files[i] = filesys_open (kfile);
+  palloc_free_page (kfile);
+  return t->files[i] != NULL ? i + FD_BASE : -1;
+}
+
+/* Writes SIZE bytes from user buffer UBUF to FD, which may be
+   STDOUT_FILENO for the console, and returns the number of bytes
+   written, or -1 if FD is not open.  The bytes are copied
+   through a kernel page, so that the console and file system
+   never fault on user memory while holding their locks. */
+static int
+sys_write (int fd, const void *ubuf, unsigned size)
+{
+  struct file *file = lookup_fd (fd);
+  const uint8_t *usrc = ubuf;
+  uint8_t *kbuf;
+  int written = 0;
+
+  if (fd != STDOUT_FILENO && file == NULL)
+    return -1;
+  if (size > 0 && !check_user (ubuf, size))
+    thread_exit ();
+  kbuf = palloc_get_page (0);
+  if (kbuf == NULL)
+    return -1;
+  while (size > 0)
+    {
+      size_t chunk = size < PGSIZE ? size : PGSIZE;
+      off_t n;
+
+      memcpy (kbuf, usrc + written, chunk);
+      if (file == NULL)
+        {
+          putbuf ((const char *) kbuf, chunk);
+          n = chunk;
+        }
+      else
+        n = file_write (file, kbuf, chunk);
+      written += n;
+      size -= n;
+      if ((size_t) n < chunk)
+        break;
+    }
+  palloc_free_page (kbuf);
+  return written;
+}
+
+/* Closes file descriptor FD, if it is open. */
+static void
+sys_close (int fd)
+{
+  struct file *file = lookup_fd (fd);
+
+  if (file != NULL)
+    {
+      file_close (file);
+      thread_current ()->files[fd - FD_BASE] = NULL;
+    }
+}
+
+#ifdef VM
+/* Maps the file open as FD at user address ADDR and returns the
+   mapping id, or -1 on failure. */
+static int
+sys_mmap (int fd, void *addr)
+{
+  struct file *file = lookup_fd (fd);
+
+  if (file == NULL)
+    return MMAP_ERROR;
+  return mmap_map (file, addr);
+}
+#endif
@@ -0,0 +1,414 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+/* Frame table.
+
+   Frames are chosen for eviction by the "second chance" clock
+   algorithm: the hand sweeps around the table, clearing the
+   accessed bits of the pages in each frame it passes, and evicts
+   the first frame none of whose pages had been accessed.  Frames
+   whose locks are held are skipped.
+
+   Locks are acquired in the order frame lock, share_lock,
+   scan_lock.  Code that holds share_lock or scan_lock only ever
+   tries to acquire a frame lock.  Frames are never freed, so it
+   is safe to wait for a frame's lock after dropping share_lock,
+   as long as the frame's identity is checked again afterward. */
+
+/* All frames. */
+static struct frame *frames;
+static size_t frame_cnt;
+
+/* Protects free_frames and hand. */
+static struct lock scan_lock;
+
+/* Frames that hold no page. */
+static struct list free_frames;
+
+/* Clock hand: index of next frame to consider for eviction. */
+static size_t hand;
+
+/* Shared frames, keyed by inode and offset. */
+static struct hash share_table;
+static struct lock share_lock;
+
+/* Statistics. */
+static long long evict_cnt;     /* Frames evicted. */
+static long long fail_cnt;      /* Allocations that failed. */
+static long long share_cnt;     /* Pages found in a shared frame. */
+static long long copy_cnt;      /* Copy-on-write copies. */
+
+static struct frame *evict_and_lock (void);
+static bool frame_accessed_recently (struct frame *);
+static void frame_unshare (struct frame *);
+static struct frame *share_lookup (struct inode *, off_t, bool writable);
+static hash_hash_func share_hash;
+static hash_less_func share_less;
+
+/* Takes over every page in the user pool as a frame. */
+void
+frame_init (void)
+{
+  void **chain = NULL;
+  void *kpage;
+  size_t i;
+
+  /* Link the pages together through their first words, since
+     we do not know how many there are until we run out. */
+  while ((kpage = palloc_get_page (PAL_USER)) != NULL)
+    {
+      *(void **) kpage = chain;
+      chain = kpage;
+      frame_cnt++;
+    }
+
+  frames = malloc (frame_cnt * sizeof *frames);
+  if (frames == NULL && frame_cnt > 0)
+    PANIC ("frame: cannot allocate frame table");
+
+  lock_init (&scan_lock);
+  list_init (&free_frames);
+  for (i = 0; i < frame_cnt; i++)
+    {
+      struct frame *f = &frames[i];
+
+      lock_init (&f->lock);
+      f->base = chain;
+      list_init (&f->pages);
+      f->inode = NULL;
+      chain = *chain;
+      list_push_back (&free_frames, &f->elem);
+    }
+
+  if (!hash_init (&share_table, share_hash, share_less, NULL))
+    PANIC ("frame: cannot allocate share table");
+  lock_init (&share_lock);
+}
+
+/* Finds a frame for PAGE, evicting another page if necessary,
+   and returns it locked, with PAGE in it.  Returns a null pointer if every frame
+   is locked or if the frame chosen for eviction could not be
+   emptied. */
+struct frame *
+frame_alloc_and_lock (struct page *page)
+{
+  struct frame *f;
+
+  lock_acquire (&scan_lock);
+  if (!list_empty (&free_frames))
+    {
+      f = list_entry (list_pop_front (&free_frames), struct frame, elem);
+      lock_release (&scan_lock);
+
+      /* A free frame may still be locked briefly by the clock
+         hand passing over it. */
+      lock_acquire (&f->lock);
+      ASSERT (list_empty (&f->pages));
+    }
+  else
+    {
+      f = evict_and_lock ();
+      if (f == NULL)
+        {
+          fail_cnt++;
+          return NULL;
+        }
+    }
+  list_push_back (&f->pages, &page->frame_elem);
+  page->frame = f;
+  return f;
+}
+
+/* Returns, locked, the shared frame for the page at offset OFS in
+   INODE, mapped writable if WRITABLE is true, with PAGE added to
+   it.  If another process already has
+   that page in memory, sets *LOADED to true.  Otherwise, sets
+   *LOADED to false, and the caller must fill the frame, or
+   release it with frame_release() on failure, before unlocking
+   it.  Returns a null pointer if no frame can be allocated. */
+struct frame *
+frame_share_and_lock (struct page *page, struct inode *inode, off_t ofs,
+                      bool writable, bool *loaded)
+{
+  struct frame *f, *g;
+
+  for (;;)
+    {
+      /* Look for the page in memory. */
+      lock_acquire (&share_lock);
+      f = share_lookup (inode, ofs, writable);
+      if (f == NULL)
+        break;
+      if (!lock_try_acquire (&f->lock))
+        {
+          /* Being filled or evicted.  Wait, then check that it
+             still holds the same page. */
+          lock_release (&share_lock);
+          lock_acquire (&f->lock);
+          lock_acquire (&share_lock);
+          if (f != share_lookup (inode, ofs, writable))
+            {
+              lock_release (&share_lock);
+              lock_release (&f->lock);
+              continue;
+            }
+        }
+      lock_release (&share_lock);
+
+      list_push_back (&f->pages, &page->frame_elem);
+      page->frame = f;
+      share_cnt++;
+      *loaded = true;
+      return f;
+    }
+  lock_release (&share_lock);
+
+  /* Not in memory.  Allocate a frame, then check that no one
+     else brought the page in while we were doing so. */
+  f = frame_alloc_and_lock (page);
+  if (f == NULL)
+    return NULL;
+  lock_acquire (&share_lock);
+  g = share_lookup (inode, ofs, writable);
+  if (g != NULL)
+    {
+      lock_release (&share_lock);
+      frame_release (page);
+      return frame_share_and_lock (page, inode, ofs, writable, loaded);
+    }
+  f->inode = inode;
+  f->ofs = ofs;
+  f->writable = writable;
+  hash_insert (&share_table, &f->share_elem);
+  lock_release (&share_lock);
+
+  *loaded = false;
+  return f;
+}
+
+/* Adds PAGE, which must not be in a frame, to frame F, which
+   must be locked. */
+void
+frame_attach (struct frame *f, struct page *page)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  ASSERT (page->frame == NULL);
+
+  list_push_back (&f->pages, &page->frame_elem);
+  page->frame = f;
+}
+
+/* Gives PAGE, whose frame must be locked, a frame of its own.
+   If no other page is in PAGE's frame, returns that frame.
+   Otherwise, moves PAGE to a newly allocated copy of the frame,
+   unlocks the old frame, and returns the copy locked.  Returns a
+   null pointer, leaving PAGE's frame unchanged and locked, if no
+   frame can be allocated. */
+struct frame *
+frame_copy (struct page *page)
+{
+  struct frame *old = page->frame;
+  struct frame *new;
+
+  ASSERT (lock_held_by_current_thread (&old->lock));
+  ASSERT (old->inode == NULL);
+
+  if (list_front (&old->pages) == list_back (&old->pages))
+    return old;
+
+  /* The old frame stays locked, so it cannot be chosen for
+     eviction while we allocate. */
+  list_remove (&page->frame_elem);
+  page->frame = NULL;
+  new = frame_alloc_and_lock (page);
+  if (new == NULL)
+    {
+      frame_attach (old, page);
+      return NULL;
+    }
+  memcpy (new->base, old->base, PGSIZE);
+  lock_release (&old->lock);
+  copy_cnt++;
+  return new;
+}
+
+/* Locks the frame that PAGE is in, if any, waiting for any
+   eviction in progress to finish.  Afterward, PAGE's frame is
+   either locked by the caller or null.  PAGE must belong to the
+   current process, since only its owner brings a page in. */
+void
+frame_lock (struct page *page)
+{
+  struct frame *f = page->frame;
+
+  if (f != NULL)
+    {
+      lock_acquire (&f->lock);
+      if (f != page->frame)
+        {
+          /* Evicted while we waited. */
+          lock_release (&f->lock);
+          ASSERT (page->frame == NULL);
+        }
+    }
+}
+
+/* Unlocks frame F. */
+void
+frame_unlock (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  lock_release (&f->lock);
+}
+
+/* Removes PAGE from its frame, which must be locked by the
+   caller, and unlocks the frame.  The frame is freed if no other
+   page is in it. */
+void
+frame_release (struct page *page)
+{
+  struct frame *f = page->frame;
+
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  list_remove (&page->frame_elem);
+  page->frame = NULL;
+  if (list_empty (&f->pages))
+    {
+      frame_unshare (f);
+      lock_acquire (&scan_lock);
+      list_push_front (&free_frames, &f->elem);
+      lock_release (&scan_lock);
+    }
+  lock_release (&f->lock);
+}
+
+/* Prints frame table statistics. */
+void
+frame_print_stats (void)
+{
+  printf ("Frames: %zu frames, %lld evictions, %lld failed allocations, "
+          "%lld shared, %lld copied\n",
+          frame_cnt, evict_cnt, fail_cnt, share_cnt, copy_cnt);
+}
+
+/* Chooses a frame to evict with the clock algorithm, writes out
+   its pages, and returns it, locked.  scan_lock must be held on
+   entry; it is released before anything is written out, so that
+   other allocations may proceed in the meantime.  Returns a null
+   pointer on failure. */
+static struct frame *
+evict_and_lock (void)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&scan_lock));
+
+  /* Two trips around the clock are enough to find a frame whose
+     accessed bits we cleared the first time, unless every frame
+     is locked. */
+  for (i = 0; i < 2 * frame_cnt; i++)
+    {
+      struct frame *f = &frames[hand];
+      if (++hand >= frame_cnt)
+        hand = 0;
+
+      if (!lock_try_acquire (&f->lock))
+        continue;
+      if (list_empty (&f->pages) || frame_accessed_recently (f))
+        {
+          lock_release (&f->lock);
+          continue;
+        }
+
+      evict_cnt++;
+      lock_release (&scan_lock);
+      while (!list_empty (&f->pages))
+        {
+          struct list_elem *e = list_front (&f->pages);
+          if (!page_out (list_entry (e, struct page, frame_elem)))
+            {
+              lock_release (&f->lock);
+              return NULL;
+            }
+        }
+      frame_unshare (f);
+      return f;
+    }
+  lock_release (&scan_lock);
+  return NULL;
+}
+
+/* Returns true if any page in frame F, which must be locked, has
+   been accessed since the last call for F, and clears their
+   accessed bits. */
+static bool
+frame_accessed_recently (struct frame *f)
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    if (page_accessed_recently (list_entry (e, struct page, frame_elem)))
+      accessed = true;
+  return accessed;
+}
+
+/* Removes frame F, which must be locked, from the share table,
+   if it is in it. */
+static void
+frame_unshare (struct frame *f)
+{
+  if (f->inode != NULL)
+    {
+      lock_acquire (&share_lock);
+      hash_delete (&share_table, &f->share_elem);
+      lock_release (&share_lock);
+      f->inode = NULL;
+    }
+}
+
+/* Returns the shared frame for offset OFS in INODE, mapped
+   writable if WRITABLE is true, or a null pointer if there is
+   none.  share_lock must be held. */
+static struct frame *
+share_lookup (struct inode *inode, off_t ofs, bool writable)
+{
+  struct frame key;
+  struct hash_elem *e;
+
+  key.inode = inode;
+  key.ofs = ofs;
+  key.writable = writable;
+  e = hash_find (&share_table, &key.share_elem);
+  return e != NULL ? hash_entry (e, struct frame, share_elem) : NULL;
+}
+
+/* Returns a hash value for shared frame E. */
+static unsigned
+share_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (e, struct frame, share_elem);
+  return hash_bytes (&f->inode, sizeof f->inode) ^ hash_int (f->ofs);
+}
+
+/* Returns true if shared frame A precedes shared frame B. */
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, share_elem);
+  const struct frame *b = hash_entry (b_, struct frame, share_elem);
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  return a->writable < b->writable;
+}
@@ -0,0 +1,56 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <hash.h>
+#include <list.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+struct inode;
+struct page;
+
+/* A physical frame of user memory.
+
+   All of the user pool is taken over by the frame table at
+   boot.  A frame's lock must be held to change which pages are
+   in it or to read or write its contents; eviction only ever
+   tries to acquire it, so a frame that is being filled or
+   emptied is effectively pinned.
+
+   A frame normally holds one process's page, but a frame that
+   holds a read-only page of a file, or a page of a memory-mapped
+   file, is "shared": it is keyed by the file's inode, the page's
+   offset, and whether it is writable, and every process that
+   maps the same page of the same file in the same way is given
+   the same frame.  Together, the shared frames form a page cache
+   for files that are mapped into memory.
+   A frame may also hold the copy-on-write pages of a process and
+   its forked children, until each writes to it. */
+struct frame
+  {
+    struct lock lock;           /* Protects the members below. */
+    void *base;                 /* Kernel virtual base address. */
+    struct list pages;          /* Pages in this frame. */
+    struct list_elem elem;      /* Element in free list, if free. */
+
+    /* For shared frames. */
+    struct hash_elem share_elem; /* Element in share table. */
+    struct inode *inode;        /* File's inode, or null if not shared. */
+    off_t ofs;                  /* Offset of page in file. */
+    bool writable;              /* Mapped writable? */
+  };
+
+void frame_init (void);
+
+struct frame *frame_alloc_and_lock (struct page *);
+struct frame *frame_share_and_lock (struct page *, struct inode *,
+                                    off_t ofs, bool writable, bool *loaded);
+void frame_attach (struct frame *, struct page *);
+struct frame *frame_copy (struct page *);
+void frame_lock (struct page *);
+void frame_unlock (struct frame *);
+void frame_release (struct page *);
+
+void frame_print_stats (void);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,121 @@
+#include "vm/mmap.h"
+#include <debug.h>
+#include <list.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+/* A memory-mapped file. */
+struct mapping
+  {
+    struct list_elem elem;      /* Element in thread's mapping list. */
+    int id;                     /* Mapping id. */
+    struct file *file;          /* File, reopened for the mapping. */
+    uint8_t *base;              /* Start of memory mapping. */
+    size_t page_cnt;            /* Number of pages mapped. */
+  };
+
+static struct mapping *mapping_lookup (int mapid);
+static void unmap (struct mapping *);
+
+/* Maps all of FILE into the current process's address space
+   starting at ADDR and returns the mapping's id.  The mapping
+   uses its own handle for FILE, so FILE may be closed afterward.
+   Returns MMAP_ERROR if FILE is empty, if ADDR is null or not
+   page-aligned, if the mapping would overlap any page already in
+   use, or on memory allocation failure. */
+int
+mmap_map (struct file *file, void *addr)
+{
+  struct thread *t = thread_current ();
+  struct mapping *m;
+  off_t length, ofs;
+
+  length = file_length (file);
+  if (length == 0 || addr == NULL || pg_ofs (addr) != 0)
+    return MMAP_ERROR;
+  if ((uintptr_t) addr + length < (uintptr_t) addr
+      || !is_user_vaddr ((uint8_t *) addr + length))
+    return MMAP_ERROR;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return MMAP_ERROR;
+  m->id = t->next_mapid++;
+  m->file = file_reopen (file);
+  m->base = addr;
+  m->page_cnt = 0;
+  if (m->file == NULL)
+    {
+      free (m);
+      return MMAP_ERROR;
+    }
+  list_push_front (&t->mappings, &m->elem);
+
+  for (ofs = 0; ofs < length; ofs += PGSIZE)
+    {
+      size_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+      if (!page_add_mmap (m->base + ofs, m->file, ofs, read_bytes))
+        {
+          unmap (m);
+          return MMAP_ERROR;
+        }
+      m->page_cnt++;
+    }
+  return m->id;
+}
+
+/* Unmaps the current process's mapping MAPID, writing modified
+   pages back to the file.  Does nothing if there is no such
+   mapping. */
+void
+mmap_unmap (int mapid)
+{
+  struct mapping *m = mapping_lookup (mapid);
+  if (m != NULL)
+    unmap (m);
+}
+
+/* Unmaps all of the current process's mappings. */
+void
+mmap_unmap_all (void)
+{
+  struct thread *t = thread_current ();
+
+  while (!list_empty (&t->mappings))
+    unmap (list_entry (list_front (&t->mappings), struct mapping, elem));
+}
+
+/* Returns the current process's mapping MAPID, or a null pointer
+   if there is none. */
+static struct mapping *
+mapping_lookup (int mapid)
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&t->mappings); e != list_end (&t->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->id == mapid)
+        return m;
+    }
+  return NULL;
+}
+
+/* Removes mapping M's pages, writing back those that were
+   modified, and frees M. */
+static void
+unmap (struct mapping *m)
+{
+  size_t i;
+
+  list_remove (&m->elem);
+  for (i = 0; i < m->page_cnt; i++)
+    page_remove (m->base + i * PGSIZE);
+  file_close (m->file);
+  free (m);
+}
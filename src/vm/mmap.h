@@ -0,0 +1,22 @@
+#ifndef VM_MMAP_H
+#define VM_MMAP_H
+
+struct file;
+
+/* Memory-mapped files.
+
+   Each mapping covers a whole file, starting at a page-aligned
+   user address, with the last page padded with zeros.  The pages
+   are brought in lazily through the supplemental page table and
+   shared with every other process that maps the same file, and
+   modified pages are written back to the file when they are
+   evicted or unmapped. */
+
+/* Returned by mmap_map() on failure. */
+#define MMAP_ERROR (-1)
+
+int mmap_map (struct file *, void *addr);
+void mmap_unmap (int mapid);
+void mmap_unmap_all (void);
+
+#endif /* vm/mmap.h */
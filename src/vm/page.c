@@ -0,0 +1,519 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/* Cache of struct page. */
+static struct kmem_cache *page_cache;
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_destroy;
+static struct page *page_add (void *upage, bool writable);
+static struct page *page_lookup (void *upage);
+static bool page_load (struct page *);
+static bool page_copy (struct page *);
+static void page_release (struct page *);
+static void page_write_back (struct page *);
+
+/* Initializes virtual memory: the frame table, swap, and the
+   supplemental page table module. */
+void
+page_init (void)
+{
+  page_cache = kmem_cache_create ("page", sizeof (struct page), 0, NULL);
+  frame_init ();
+  swap_init ();
+}
+
+/* Creates an empty supplemental page table for the current
+   process.  Returns true if successful, false on memory
+   allocation failure. */
+bool
+page_table_create (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->pages == NULL);
+  t->pages = malloc (sizeof *t->pages);
+  if (t->pages == NULL)
+    return false;
+  if (!hash_init (t->pages, page_hash, page_less, NULL))
+    {
+      free (t->pages);
+      t->pages = NULL;
+      return false;
+    }
+  return true;
+}
+
+/* Copies the address space described by PARENT's supplemental
+   page table into the current process's, which must be empty,
+   for fork().  PARENT must not run meanwhile.  Returns true if
+   successful, false on memory allocation failure. */
+bool
+page_table_copy (struct thread *parent)
+{
+  struct hash_iterator i;
+
+  hash_first (&i, parent->pages);
+  while (hash_next (&i))
+    if (!page_copy (hash_entry (hash_cur (&i), struct page, elem)))
+      return false;
+  return true;
+}
+
+/* Destroys the current process's supplemental page table, if it
+   has one, releasing its pages' frames and swap slots and
+   unmapping them from its page directory.  This must happen
+   before the page directory is destroyed, because the frames
+   belong to the frame table, not to the page directory. */
+void
+page_table_destroy (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->pages != NULL)
+    {
+      hash_destroy (t->pages, page_destroy);
+      free (t->pages);
+      t->pages = NULL;
+    }
+}
+
+/* Adds a page at UPAGE to the current process's address space
+   whose first READ_BYTES bytes are read from FILE starting at
+   offset OFS and whose remaining bytes are zeroed, when it is
+   first touched.  FILE must remain open until the process
+   exits.  Returns true if successful, false if UPAGE is already
+   in use or on memory allocation failure. */
+bool
+page_add_file (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable)
+{
+  struct page *p;
+
+  ASSERT (read_bytes <= PGSIZE);
+
+  if (read_bytes == 0)
+    return page_add_zero (upage, writable);
+
+  p = page_add (upage, writable);
+  if (p == NULL)
+    return false;
+  p->type = PAGE_FILE;
+  p->file = file;
+  p->ofs = ofs;
+  p->read_bytes = read_bytes;
+  return true;
+}
+
+/* Adds a page of zeros at UPAGE to the current process's address
+   space, to be allocated when it is first touched.  Returns true
+   if successful, false if UPAGE is already in use or on memory
+   allocation failure. */
+bool
+page_add_zero (void *upage, bool writable)
+{
+  struct page *p = page_add (upage, writable);
+  if (p == NULL)
+    return false;
+  p->type = PAGE_ZERO;
+  return true;
+}
+
+/* Adds a page at UPAGE to the current process's address space
+   that maps the READ_BYTES bytes at offset OFS in FILE, followed
+   by zeros.  Changes to the page are written back to FILE.  FILE
+   must remain open until the page is removed.  Returns true if
+   successful, false if UPAGE is already in use or on memory
+   allocation failure. */
+bool
+page_add_mmap (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes)
+{
+  struct page *p;
+
+  ASSERT (read_bytes > 0 && read_bytes <= PGSIZE);
+
+  p = page_add (upage, true);
+  if (p == NULL)
+    return false;
+  p->type = PAGE_MMAP;
+  p->file = file;
+  p->ofs = ofs;
+  p->read_bytes = read_bytes;
+  return true;
+}
+
+/* Removes the page at UPAGE, which must exist, from the current
+   process's address space, writing it back to its file first if
+   it is a modified page of a memory-mapped file. */
+void
+page_remove (void *upage)
+{
+  struct page *p = page_lookup (upage);
+
+  ASSERT (p != NULL);
+  hash_delete (thread_current ()->pages, &p->elem);
+  page_release (p);
+  kmem_cache_free (page_cache, p);
+}
+
+/* Brings the page containing FAULT_ADDR into memory and maps it
+   in the current process's page directory.  Returns true if
+   successful, false if FAULT_ADDR is not in a page that the
+   process may access or if memory or the file read fails. */
+bool
+page_in (void *fault_addr)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+  bool success;
+
+  if (t->pages == NULL || !is_user_vaddr (fault_addr))
+    return false;
+  p = page_lookup (pg_round_down (fault_addr));
+  if (p == NULL)
+    return false;
+
+  /* The page may still be in a frame if an attempt to evict it
+     failed, or if it is being evicted right now, in which case
+     this waits for that to finish. */
+  frame_lock (p);
+  if (p->frame == NULL && !page_load (p))
+    return false;
+
+  success = pagedir_set_page (t->pagedir, p->upage, p->frame->base,
+                              p->writable && !p->cow);
+  frame_unlock (p->frame);
+  return success;
+}
+
+/* Handles a write to the copy-on-write page containing
+   FAULT_ADDR by giving the page a private, writable copy of its
+   frame, unless no other page still shares it, in which case the
+   frame is simply made writable.  Returns true if successful,
+   false if FAULT_ADDR is not in a copy-on-write page or if no
+   frame is available. */
+bool
+page_copy_on_write (void *fault_addr)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+  struct frame *f;
+  bool success;
+
+  if (t->pages == NULL || !is_user_vaddr (fault_addr))
+    return false;
+  p = page_lookup (pg_round_down (fault_addr));
+  if (p == NULL || !p->cow)
+    return false;
+
+  frame_lock (p);
+  if (p->frame == NULL)
+    {
+      /* Evicted meanwhile, which ended the sharing. */
+      ASSERT (!p->cow);
+      return page_in (fault_addr);
+    }
+
+  f = frame_copy (p);
+  if (f == NULL)
+    {
+      frame_unlock (p->frame);
+      return false;
+    }
+  p->cow = false;
+  pagedir_clear_page (t->pagedir, p->upage);
+  success = pagedir_set_page (t->pagedir, p->upage, f->base, true);
+  frame_unlock (f);
+  return success;
+}
+
+/* Evicts page P from its frame, which the caller must have
+   locked, by unmapping it and writing it to its file or to swap
+   if it cannot be recovered otherwise.  On success, removes P
+   from the frame's page list and clears P's frame.  Returns false if P must be written to swap but swap is
+   full, in which case P stays in its frame, unmapped, and its
+   owner's next access maps it again. */
+bool
+page_out (struct page *p)
+{
+  uint32_t *pd = p->thread->pagedir;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  /* Unmap first, so that the owner cannot modify the page after
+     we check whether it is dirty.  Its next access will fault
+     and wait for the frame lock. */
+  pagedir_clear_page (pd, p->upage);
+  if (p->type == PAGE_MMAP)
+    page_write_back (p);
+  else if (pagedir_is_dirty (pd, p->upage))
+    p->modified = true;
+
+  if (p->modified)
+    {
+      p->swap_slot = swap_out (p->frame->base);
+      if (p->swap_slot == SWAP_ERROR)
+        return false;
+    }
+
+  /* Each page that shared the frame comes back in a frame of its
+     own.  P must leave the frame's page list before its frame is
+     cleared, because once it is, its owner may free P or put it
+     in another frame without taking this frame's lock. */
+  p->cow = false;
+  list_remove (&p->frame_elem);
+  p->frame = NULL;
+  return true;
+}
+
+/* Returns true if page P, which must be in a frame locked by the
+   caller, has been accessed since the last call for P, and
+   clears its accessed bit. */
+bool
+page_accessed_recently (struct page *p)
+{
+  uint32_t *pd = p->thread->pagedir;
+  bool accessed;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  accessed = pagedir_is_accessed (pd, p->upage);
+  if (accessed)
+    pagedir_set_accessed (pd, p->upage, false);
+  return accessed;
+}
+
+/* Creates and adds to the current process's page table a page at
+   UPAGE and returns it, or returns a null pointer if UPAGE is
+   already in use or on memory allocation failure. */
+static struct page *
+page_add (void *upage, bool writable)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  p = kmem_cache_alloc (page_cache);
+  if (p == NULL)
+    return NULL;
+  p->upage = upage;
+  p->thread = t;
+  p->writable = writable;
+  p->frame = NULL;
+  p->swap_slot = SWAP_ERROR;
+  p->modified = false;
+  p->cow = false;
+  if (hash_insert (t->pages, &p->elem) != NULL)
+    {
+      kmem_cache_free (page_cache, p);
+      return NULL;
+    }
+  return p;
+}
+
+/* Returns the page at UPAGE in the current process's page table,
+   or a null pointer if there is none. */
+static struct page *
+page_lookup (void *upage)
+{
+  struct page p;
+  struct hash_elem *e;
+
+  p.upage = upage;
+  e = hash_find (thread_current ()->pages, &p.elem);
+  return e != NULL ? hash_entry (e, struct page, elem) : NULL;
+}
+
+/* Allocates a frame for page P, which must not be in one, and
+   fills it from swap, P's file, or zeros.  Returns true with P's
+   frame locked if successful, false if no frame could be
+   obtained or the file read fails. */
+static bool
+page_load (struct page *p)
+{
+  struct frame *f;
+
+  ASSERT (p->frame == NULL);
+
+  if ((p->type == PAGE_FILE && !p->writable) || p->type == PAGE_MMAP)
+    {
+      /* Read-only file pages can never be modified, and changes
+         to mapped files are meant to be seen by everyone who maps
+         them, so any process that maps the same page may share
+         the frame.  A page already in memory is mapped as it is,
+         without copying. */
+      bool loaded;
+
+      ASSERT (p->swap_slot == SWAP_ERROR);
+      f = frame_share_and_lock (p, file_get_inode (p->file), p->ofs,
+                                p->writable, &loaded);
+      if (f == NULL)
+        return false;
+      if (loaded)
+        return true;
+    }
+  else
+    {
+      f = frame_alloc_and_lock (p);
+      if (f == NULL)
+        return false;
+    }
+
+  if (p->swap_slot != SWAP_ERROR)
+    {
+      swap_in (p->swap_slot, f->base);
+      p->swap_slot = SWAP_ERROR;
+    }
+  else if (p->type == PAGE_FILE || p->type == PAGE_MMAP)
+    {
+      if (file_read_at (p->file, f->base, p->read_bytes, p->ofs)
+          != (off_t) p->read_bytes)
+        {
+          frame_release (p);
+          return false;
+        }
+      memset ((uint8_t *) f->base + p->read_bytes, 0,
+              PGSIZE - p->read_bytes);
+    }
+  else
+    memset (f->base, 0, PGSIZE);
+  return true;
+}
+
+/* Adds a copy of page P, which belongs to the parent of the
+   current process, to the current process's page table.  If P is
+   in memory or in swap, the copy shares P's frame, and both
+   become copy-on-write if they are writable.  Memory-mapped
+   files are not inherited, so their pages are skipped.  Returns
+   true if successful, false on memory allocation failure. */
+static bool
+page_copy (struct page *p)
+{
+  struct thread *t = thread_current ();
+  struct page *c;
+  struct frame *f;
+  bool success;
+
+  if (p->type == PAGE_MMAP)
+    return true;
+
+  c = page_add (p->upage, p->writable);
+  if (c == NULL)
+    return false;
+  c->type = p->type;
+  c->file = p->file == p->thread->exec_file ? t->exec_file : p->file;
+  c->ofs = p->ofs;
+  c->read_bytes = p->read_bytes;
+
+  /* Bring P in from swap, so that the swap slot need not be
+     shared. */
+  frame_lock (p);
+  if (p->frame == NULL)
+    {
+      if (p->swap_slot == SWAP_ERROR)
+        return true;
+      if (!page_load (p))
+        return false;
+    }
+  f = p->frame;
+
+  /* Write-protect P, remembering whether it had been written. */
+  if (p->writable && !p->cow)
+    {
+      uint32_t *pd = p->thread->pagedir;
+
+      if (pagedir_is_dirty (pd, p->upage))
+        p->modified = true;
+      pagedir_set_writable (pd, p->upage, false);
+      p->cow = true;
+    }
+  c->modified = p->modified;
+  c->cow = p->cow;
+
+  frame_attach (f, c);
+  success = pagedir_set_page (t->pagedir, c->upage, f->base,
+                              c->writable && !c->cow);
+  frame_unlock (f);
+  return success;
+}
+
+/* Returns a hash value for page E. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, elem);
+  return hash_int ((uintptr_t) p->upage >> PGBITS);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, elem);
+  const struct page *b = hash_entry (b_, struct page, elem);
+  return a->upage < b->upage;
+}
+
+/* Frees page E. */
+static void
+page_destroy (struct hash_elem *e, void *aux UNUSED)
+{
+  struct page *p = hash_entry (e, struct page, elem);
+
+  page_release (p);
+  kmem_cache_free (page_cache, p);
+}
+
+/* Releases page P's frame and swap slot, if any, unmapping it
+   and writing it back to its file first if it is a modified
+   page of a memory-mapped file. */
+static void
+page_release (struct page *p)
+{
+  frame_lock (p);
+  if (p->frame != NULL)
+    {
+      pagedir_clear_page (p->thread->pagedir, p->upage);
+      if (p->type == PAGE_MMAP)
+        page_write_back (p);
+      frame_release (p);
+    }
+  if (p->swap_slot != SWAP_ERROR)
+    swap_free (p->swap_slot);
+}
+
+/* Writes page P of a memory-mapped file back to the file, if
+   P's process modified it.  P's frame must be locked and P must
+   already be unmapped, so that its process cannot change it
+   during the write. */
+static void
+page_write_back (struct page *p)
+{
+  uint32_t *pd = p->thread->pagedir;
+
+  ASSERT (p->type == PAGE_MMAP);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  if (pagedir_is_dirty (pd, p->upage))
+    {
+      file_write_at (p->file, p->frame->base, p->read_bytes, p->ofs);
+      pagedir_set_dirty (pd, p->upage, false);
+    }
+}
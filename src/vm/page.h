@@ -0,0 +1,83 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct frame;
+struct thread;
+
+/* Supplemental page table.
+
+   Each process has a hash table of the pages in its address
+   space, keyed by user virtual address, that records where each
+   page's contents come from.  A page is not given a frame until
+   the process first touches it, at which point page_fault()
+   calls page_in() to read or zero it.  When memory runs short,
+   the frame table evicts pages with page_out(): a page whose
+   contents still match its file or zeros is simply dropped, and
+   any other page is written to swap.
+
+   Read-only pages of files are shared: every process that maps
+   the same page of the same file uses the same frame.
+
+   Pages of memory-mapped files are shared the same way, even
+   though they are writable, and are written back to their files
+   instead of to swap, only if they were modified, when they are
+   evicted or unmapped.
+
+   fork() shares the parent's resident pages with the child.
+   Writable pages become "copy-on-write": they are mapped
+   read-only in both processes, and the first write to one
+   faults and gives it a private copy of the frame. */
+
+/* Where a page's initial contents come from. */
+enum page_type
+  {
+    PAGE_ZERO,                  /* All zeros. */
+    PAGE_FILE,                  /* Read from a file, rest zeros. */
+    PAGE_MMAP                   /* Memory-mapped file. */
+  };
+
+/* A page of user virtual memory. */
+struct page
+  {
+    struct hash_elem elem;      /* Element in thread's page table. */
+    void *upage;                /* User virtual address. */
+    struct thread *thread;      /* Owning thread. */
+    bool writable;              /* True if user may write. */
+    enum page_type type;        /* Source of initial contents. */
+
+    /* Protected by the frame's lock while in a frame. */
+    struct frame *frame;        /* Frame, or null if not in memory. */
+    struct list_elem frame_elem; /* Element in frame's page list. */
+    size_t swap_slot;           /* Swap slot, or SWAP_ERROR. */
+    bool modified;              /* Contents differ from the source. */
+    bool cow;                   /* Copy-on-write: frame is shared. */
+
+    /* For PAGE_FILE and PAGE_MMAP. */
+    struct file *file;          /* File to read. */
+    off_t ofs;                  /* Offset in file. */
+    size_t read_bytes;          /* Bytes to read; the rest are zeroed. */
+  };
+
+void page_init (void);
+
+bool page_table_create (void);
+bool page_table_copy (struct thread *parent);
+void page_table_destroy (void);
+
+bool page_add_file (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes, bool writable);
+bool page_add_zero (void *upage, bool writable);
+bool page_add_mmap (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes);
+void page_remove (void *upage);
+bool page_in (void *fault_addr);
+bool page_copy_on_write (void *fault_addr);
+bool page_out (struct page *);
+bool page_accessed_recently (struct page *);
+
+#endif /* vm/page.h */